@@ -3,7 +3,9 @@
 
 #include <string>
 #include <functional>
+#include <optional>
 #include <set>
+#include <vector>
 
 namespace transport
 {
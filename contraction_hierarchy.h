@@ -0,0 +1,620 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph
+{
+
+// Contraction hierarchies: vertices are contracted one by one in order of
+// importance, adding shortcut edges that preserve shortest paths among the
+// remaining vertices. A query is a bidirectional Dijkstra that only follows
+// edges leading to more important vertices.
+template< typename Weight >
+class ContractionHierarchy
+{
+private:
+     using Graph = DirectedWeightedGraph< Weight >;
+
+public:
+     explicit ContractionHierarchy( const Graph& graph );
+
+     // Returns the route weight and puts its edges into edges, whose storage
+     // is reused across calls; nullopt if to is unreachable from from
+     std::optional< Weight > FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges ) const;
+
+     class Reader;
+
+     size_t GetShortcutCount() const;
+
+     // Writes the hierarchy edges and the upward adjacency to output
+     template< typename Output >
+     void Save( Output& output ) const;
+
+     // Hierarchy written by Save, without contracting graph again. graph must
+     // be the one the saved hierarchy was built on. Edges or lists that don't
+     // fit graph are reported through input.Expect( valid, what ), which has to throw
+     template< typename Input >
+     static std::unique_ptr< ContractionHierarchy > Load( const Graph& graph, Input& input );
+
+private:
+     static constexpr EdgeId NO_EDGE = std::numeric_limits< EdgeId >::max();
+     static constexpr Weight UNREACHABLE = std::numeric_limits< Weight >::has_infinity
+                                           ? std::numeric_limits< Weight >::infinity()
+                                           : std::numeric_limits< Weight >::max();
+     // Witness searches give up after settling this many vertices, which may
+     // only add superfluous shortcuts, never lose a shortest path
+     static constexpr size_t WITNESS_SETTLE_LIMIT = 64;
+
+     // Either an edge of the original graph or a shortcut over two hierarchy edges
+     struct HierarchyEdge
+     {
+          VertexId from;
+          VertexId to;
+          Weight weight;
+          EdgeId original;
+          EdgeId first;
+          EdgeId second;
+     };
+
+     struct Shortcut
+     {
+          VertexId from;
+          VertexId to;
+          Weight weight;
+          EdgeId first;
+          EdgeId second;
+     };
+
+     struct ContractionState
+     {
+          std::vector< std::vector< EdgeId > > out;
+          std::vector< std::vector< EdgeId > > in;
+          std::vector< bool > contracted;
+          std::vector< int64_t > contracted_neighbours;
+          std::vector< Weight > witness_weights;
+          std::vector< VertexId > witness_touched;
+          std::vector< bool > witness_targets;
+     };
+
+     struct SearchSpace
+     {
+          std::vector< Weight > weights;
+          std::vector< EdgeId > parents;
+          std::vector< VertexId > touched;
+     };
+
+     // Everything a query writes, kept between queries so they don't allocate
+     struct QueryState
+     {
+          SearchSpace forward;
+          SearchSpace backward;
+          std::vector< EdgeId > hierarchy_edges;
+          std::vector< EdgeId > unpack_stack;
+     };
+
+     const Graph& graph_;
+     std::vector< HierarchyEdge > edges_;
+     // upward_out_[v]: edges v -> w, upward_in_[v]: edges w -> v, rank of w greater than rank of v
+     std::vector< std::vector< EdgeId > > upward_out_;
+     std::vector< std::vector< EdgeId > > upward_in_;
+
+     mutable QueryState query_;
+
+     struct LoadTag
+     {
+     };
+
+     // empty hierarchy to be filled by Load
+     ContractionHierarchy( const Graph& graph, LoadTag )
+               : graph_( graph )
+               , query_( MakeQueryState() )
+     {}
+
+     // adjacency lists as offsets into one array of edge ids
+     template< typename Output >
+     static void SaveLists( Output& output, const std::vector< std::vector< EdgeId > >& lists )
+     {
+          std::vector< uint64_t > offsets = { 0 };
+          std::vector< EdgeId > ids;
+          for( const auto& list : lists )
+          {
+               ids.insert( std::end( ids ), std::begin( list ), std::end( list ) );
+               offsets.push_back( ids.size() );
+          }
+          output.WriteArray( offsets );
+          output.WriteArray( ids );
+     }
+
+     template< typename Input >
+     static std::vector< std::vector< EdgeId > > LoadLists( Input& input, size_t vertex_count )
+     {
+          const auto offsets = input.template ReadArray< uint64_t >();
+          const auto ids = input.template ReadArray< EdgeId >();
+          input.Expect( offsets.size() == vertex_count + 1 && offsets.front() == 0 && offsets.back() == ids.size()
+                        && std::is_sorted( std::begin( offsets ), std::end( offsets ) ),
+                        "hierarchy adjacency offsets" );
+          std::vector< std::vector< EdgeId > > lists( vertex_count );
+          for( size_t vertex = 0; vertex < vertex_count; ++vertex )
+          {
+               lists[ vertex ].assign( std::next( std::begin( ids ), offsets[ vertex ] ),
+                                       std::next( std::begin( ids ), offsets[ vertex + 1 ] ) );
+          }
+          return lists;
+     }
+
+     QueryState MakeQueryState() const
+     {
+          const SearchSpace space { std::vector< Weight >( graph_.GetVertexCount(), UNREACHABLE ),
+                                    std::vector< EdgeId >( graph_.GetVertexCount(), NO_EDGE ), {} };
+          return { space, space, {}, {} };
+     }
+
+     // Only touches the given query state, whose search spaces are left cleared
+     std::optional< Weight > FindRoute( VertexId from, VertexId to, QueryState& query, std::vector< EdgeId >& edges ) const;
+
+     // Stops once every vertex in witness_targets is settled
+     void RunWitnessSearch( ContractionState& state, VertexId source, VertexId excluded,
+                            Weight max_weight, size_t target_count ) const
+     {
+          using QueueItem = std::pair< Weight, VertexId >;
+          std::priority_queue< QueueItem, std::vector< QueueItem >, std::greater<> > queue;
+
+          state.witness_weights[ source ] = 0;
+          state.witness_touched.push_back( source );
+          queue.push( { 0, source } );
+          for( size_t settled = 0; !queue.empty() && settled < WITNESS_SETTLE_LIMIT; ++settled )
+          {
+               const auto [ weight, vertex ] = queue.top();
+               queue.pop();
+               if( weight > max_weight )
+               {
+                    break;
+               }
+               if( state.witness_weights[ vertex ] < weight )
+               {
+                    continue;
+               }
+               if( state.witness_targets[ vertex ] && --target_count == 0 )
+               {
+                    break;
+               }
+               for( const EdgeId edge_id : state.out[ vertex ] )
+               {
+                    const auto& edge = edges_[ edge_id ];
+                    if( edge.to == excluded || state.contracted[ edge.to ] )
+                    {
+                         continue;
+                    }
+                    const Weight candidate_weight = weight + edge.weight;
+                    if( candidate_weight < state.witness_weights[ edge.to ] )
+                    {
+                         if( state.witness_weights[ edge.to ] == UNREACHABLE )
+                         {
+                              state.witness_touched.push_back( edge.to );
+                         }
+                         state.witness_weights[ edge.to ] = candidate_weight;
+                         queue.push( { candidate_weight, edge.to } );
+                    }
+               }
+          }
+     }
+
+     void ClearWitnessSearch( ContractionState& state ) const
+     {
+          for( const VertexId vertex : state.witness_touched )
+          {
+               state.witness_weights[ vertex ] = UNREACHABLE;
+          }
+          state.witness_touched.clear();
+     }
+
+     // Keeps the lightest edge per neighbour among the uncontracted ones
+     std::vector< EdgeId > GetLightestEdges( const ContractionState& state, const std::vector< EdgeId >& edge_ids,
+                                             VertexId vertex, bool outgoing ) const
+     {
+          std::unordered_map< VertexId, EdgeId > lightest;
+          for( const EdgeId edge_id : edge_ids )
+          {
+               const auto& edge = edges_[ edge_id ];
+               const VertexId neighbour = outgoing ? edge.to : edge.from;
+               if( neighbour == vertex || state.contracted[ neighbour ] )
+               {
+                    continue;
+               }
+               auto [ it, inserted ] = lightest.emplace( neighbour, edge_id );
+               if( !inserted && edge.weight < edges_[ it->second ].weight )
+               {
+                    it->second = edge_id;
+               }
+          }
+          std::vector< EdgeId > result;
+          result.reserve( lightest.size() );
+          for( const auto& [ neighbour, edge_id ] : lightest )
+          {
+               result.push_back( edge_id );
+          }
+          return result;
+     }
+
+     std::vector< Shortcut > FindShortcuts( ContractionState& state, VertexId vertex ) const
+     {
+          const std::vector< EdgeId > in_edges = GetLightestEdges( state, state.in[ vertex ], vertex, false );
+          const std::vector< EdgeId > out_edges = GetLightestEdges( state, state.out[ vertex ], vertex, true );
+
+          std::vector< Shortcut > shortcuts;
+          for( const EdgeId in_edge_id : in_edges )
+          {
+               const auto& in_edge = edges_[ in_edge_id ];
+               Weight max_weight = 0;
+               size_t target_count = 0;
+               for( const EdgeId out_edge_id : out_edges )
+               {
+                    const auto& out_edge = edges_[ out_edge_id ];
+                    if( out_edge.to != in_edge.from )
+                    {
+                         max_weight = std::max( max_weight, in_edge.weight + out_edge.weight );
+                         state.witness_targets[ out_edge.to ] = true;
+                         ++target_count;
+                    }
+               }
+               if( target_count == 0 )
+               {
+                    continue;
+               }
+
+               RunWitnessSearch( state, in_edge.from, vertex, max_weight, target_count );
+               for( const EdgeId out_edge_id : out_edges )
+               {
+                    const auto& out_edge = edges_[ out_edge_id ];
+                    const Weight candidate_weight = in_edge.weight + out_edge.weight;
+                    if( out_edge.to != in_edge.from && candidate_weight < state.witness_weights[ out_edge.to ] )
+                    {
+                         shortcuts.push_back( { in_edge.from, out_edge.to, candidate_weight, in_edge_id, out_edge_id } );
+                    }
+                    state.witness_targets[ out_edge.to ] = false;
+               }
+               ClearWitnessSearch( state );
+          }
+          return shortcuts;
+     }
+
+     // Edge difference plus the number of already contracted neighbours,
+     // which spreads contraction uniformly over the graph
+     int64_t GetPriority( const ContractionState& state, VertexId vertex, size_t shortcut_count ) const
+     {
+          return static_cast< int64_t >( shortcut_count )
+                 - static_cast< int64_t >( state.in[ vertex ].size() + state.out[ vertex ].size() )
+                 + state.contracted_neighbours[ vertex ];
+     }
+
+     EdgeId AddHierarchyEdge( ContractionState& state, const HierarchyEdge& edge )
+     {
+          edges_.push_back( edge );
+          const EdgeId id = edges_.size() - 1;
+          state.out[ edge.from ].push_back( id );
+          state.in[ edge.to ].push_back( id );
+          return id;
+     }
+
+     void Contract( ContractionState& state, VertexId vertex, const std::vector< Shortcut >& shortcuts )
+     {
+          for( const auto& shortcut : shortcuts )
+          {
+               AddHierarchyEdge( state, { shortcut.from, shortcut.to, shortcut.weight,
+                                          NO_EDGE, shortcut.first, shortcut.second } );
+          }
+
+          state.contracted[ vertex ] = true;
+          for( const EdgeId edge_id : state.out[ vertex ] )
+          {
+               const VertexId neighbour = edges_[ edge_id ].to;
+               upward_out_[ vertex ].push_back( edge_id );
+               ++state.contracted_neighbours[ neighbour ];
+               std::erase_if( state.in[ neighbour ], [ this, vertex ]( EdgeId id )
+               { return edges_[ id ].from == vertex; } );
+          }
+          for( const EdgeId edge_id : state.in[ vertex ] )
+          {
+               const VertexId neighbour = edges_[ edge_id ].from;
+               upward_in_[ vertex ].push_back( edge_id );
+               ++state.contracted_neighbours[ neighbour ];
+               std::erase_if( state.out[ neighbour ], [ this, vertex ]( EdgeId id )
+               { return edges_[ id ].to == vertex; } );
+          }
+          state.out[ vertex ].clear();
+          state.in[ vertex ].clear();
+     }
+
+     void ClearSearchSpace( SearchSpace& space ) const
+     {
+          for( const VertexId vertex : space.touched )
+          {
+               space.weights[ vertex ] = UNREACHABLE;
+               space.parents[ vertex ] = NO_EDGE;
+          }
+          space.touched.clear();
+     }
+
+     void UnpackEdge( EdgeId edge_id, std::vector< EdgeId >& stack, std::vector< EdgeId >& route ) const
+     {
+          stack.assign( 1, edge_id );
+          while( !stack.empty() )
+          {
+               const auto& edge = edges_[ stack.back() ];
+               stack.pop_back();
+               if( edge.original != NO_EDGE )
+               {
+                    route.push_back( edge.original );
+               }
+               else
+               {
+                    stack.push_back( edge.second );
+                    stack.push_back( edge.first );
+               }
+          }
+     }
+};
+
+// Query state of one thread. Readers only read the hierarchy, so any number
+// of them may run at once while it and its graph are left unchanged
+template< typename Weight >
+class ContractionHierarchy< Weight >::Reader
+{
+public:
+     explicit Reader( const ContractionHierarchy& hierarchy )
+               : hierarchy_( hierarchy )
+               , query_( hierarchy.MakeQueryState() )
+     {}
+
+     std::optional< Weight > FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges )
+     {
+          return hierarchy_.FindRoute( from, to, query_, edges );
+     }
+
+private:
+     const ContractionHierarchy& hierarchy_;
+     QueryState query_;
+};
+
+template< typename Weight >
+ContractionHierarchy< Weight >::ContractionHierarchy( const Graph& graph )
+          : graph_( graph )
+          , upward_out_( graph.GetVertexCount() )
+          , upward_in_( graph.GetVertexCount() )
+          , query_( MakeQueryState() )
+{
+     const size_t vertex_count = graph.GetVertexCount();
+     ContractionState state { std::vector< std::vector< EdgeId > >( vertex_count ),
+                              std::vector< std::vector< EdgeId > >( vertex_count ),
+                              std::vector< bool >( vertex_count, false ),
+                              std::vector< int64_t >( vertex_count, 0 ),
+                              std::vector< Weight >( vertex_count, UNREACHABLE ),
+                              {},
+                              std::vector< bool >( vertex_count, false ) };
+
+     // Only the lightest of parallel edges can be part of a shortest path
+     for( VertexId vertex = 0; vertex < vertex_count; ++vertex )
+     {
+          std::unordered_map< VertexId, EdgeId > lightest;
+          for( const EdgeId edge_id : graph.GetIncidentEdges( vertex ) )
+          {
+               const auto& edge = graph.GetEdge( edge_id );
+               assert( edge.weight >= 0 );
+               if( edge.from == edge.to )
+               {
+                    continue;
+               }
+               auto [ it, inserted ] = lightest.emplace( edge.to, edge_id );
+               if( !inserted && edge.weight < graph.GetEdge( it->second ).weight )
+               {
+                    it->second = edge_id;
+               }
+          }
+          for( const auto& [ to, edge_id ] : lightest )
+          {
+               AddHierarchyEdge( state, { vertex, to, graph.GetEdge( edge_id ).weight, edge_id, NO_EDGE, NO_EDGE } );
+          }
+     }
+
+     // Lazy updates: a vertex is contracted only if its recomputed priority
+     // is still the smallest one, otherwise it goes back into the queue
+     using QueueItem = std::pair< int64_t, VertexId >;
+     std::priority_queue< QueueItem, std::vector< QueueItem >, std::greater<> > order;
+     for( VertexId vertex = 0; vertex < vertex_count; ++vertex )
+     {
+          order.push( { GetPriority( state, vertex, FindShortcuts( state, vertex ).size() ), vertex } );
+     }
+     while( !order.empty() )
+     {
+          const VertexId vertex = order.top().second;
+          order.pop();
+          const std::vector< Shortcut > shortcuts = FindShortcuts( state, vertex );
+          const int64_t priority = GetPriority( state, vertex, shortcuts.size() );
+          if( !order.empty() && priority > order.top().first )
+          {
+               order.push( { priority, vertex } );
+               continue;
+          }
+          Contract( state, vertex, shortcuts );
+     }
+}
+
+template< typename Weight >
+std::optional< Weight >
+ContractionHierarchy< Weight >::FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges ) const
+{
+     return FindRoute( from, to, query_, edges );
+}
+
+template< typename Weight >
+std::optional< Weight >
+ContractionHierarchy< Weight >::FindRoute( VertexId from, VertexId to, QueryState& query,
+                                           std::vector< EdgeId >& edges ) const
+{
+     SearchSpace& forward = query.forward;
+     SearchSpace& backward = query.backward;
+     edges.clear();
+     using QueueItem = std::pair< Weight, VertexId >;
+     using Queue = std::priority_queue< QueueItem, std::vector< QueueItem >, std::greater<> >;
+     Queue forward_queue;
+     Queue backward_queue;
+
+     forward.weights[ from ] = 0;
+     forward.touched.push_back( from );
+     forward_queue.push( { 0, from } );
+     backward.weights[ to ] = 0;
+     backward.touched.push_back( to );
+     backward_queue.push( { 0, to } );
+
+     Weight best_weight = UNREACHABLE;
+     VertexId meeting_vertex = from;
+     while( !forward_queue.empty() || !backward_queue.empty() )
+     {
+          const bool forward_step = backward_queue.empty()
+                                    || ( !forward_queue.empty() && forward_queue.top().first <= backward_queue.top().first );
+          Queue& queue = forward_step ? forward_queue : backward_queue;
+          SearchSpace& space = forward_step ? forward : backward;
+          const SearchSpace& other_space = forward_step ? backward : forward;
+
+          const auto [ weight, vertex ] = queue.top();
+          queue.pop();
+          if( weight >= best_weight )
+          {
+               queue = Queue();
+               continue;
+          }
+          if( space.weights[ vertex ] < weight )
+          {
+               continue;
+          }
+          if( other_space.weights[ vertex ] != UNREACHABLE && weight + other_space.weights[ vertex ] < best_weight )
+          {
+               best_weight = weight + other_space.weights[ vertex ];
+               meeting_vertex = vertex;
+          }
+
+          for( const EdgeId edge_id : forward_step ? upward_out_[ vertex ] : upward_in_[ vertex ] )
+          {
+               const auto& edge = edges_[ edge_id ];
+               const VertexId next = forward_step ? edge.to : edge.from;
+               const Weight candidate_weight = weight + edge.weight;
+               if( candidate_weight < space.weights[ next ] )
+               {
+                    if( space.weights[ next ] == UNREACHABLE )
+                    {
+                         space.touched.push_back( next );
+                    }
+                    space.weights[ next ] = candidate_weight;
+                    space.parents[ next ] = edge_id;
+                    queue.push( { candidate_weight, next } );
+               }
+          }
+     }
+
+     if( best_weight == UNREACHABLE )
+     {
+          ClearSearchSpace( forward );
+          ClearSearchSpace( backward );
+          return std::nullopt;
+     }
+
+     std::vector< EdgeId >& hierarchy_edges = query.hierarchy_edges;
+     hierarchy_edges.clear();
+     for( EdgeId edge_id = forward.parents[ meeting_vertex ]; edge_id != NO_EDGE;
+          edge_id = forward.parents[ edges_[ edge_id ].from ] )
+     {
+          hierarchy_edges.push_back( edge_id );
+     }
+     std::reverse( std::begin( hierarchy_edges ), std::end( hierarchy_edges ) );
+     for( EdgeId edge_id = backward.parents[ meeting_vertex ]; edge_id != NO_EDGE;
+          edge_id = backward.parents[ edges_[ edge_id ].to ] )
+     {
+          hierarchy_edges.push_back( edge_id );
+     }
+     ClearSearchSpace( forward );
+     ClearSearchSpace( backward );
+
+     for( const EdgeId edge_id : hierarchy_edges )
+     {
+          UnpackEdge( edge_id, query.unpack_stack, edges );
+     }
+     return best_weight;
+}
+
+template< typename Weight >
+template< typename Output >
+void ContractionHierarchy< Weight >::Save( Output& output ) const
+{
+     output.WriteArray( edges_ );
+     SaveLists( output, upward_out_ );
+     SaveLists( output, upward_in_ );
+}
+
+template< typename Weight >
+template< typename Input >
+std::unique_ptr< ContractionHierarchy< Weight > > ContractionHierarchy< Weight >::Load( const Graph& graph, Input& input )
+{
+     const size_t vertex_count = graph.GetVertexCount();
+     std::unique_ptr< ContractionHierarchy > hierarchy( new ContractionHierarchy( graph, LoadTag {} ) );
+     const auto& edges = hierarchy->edges_ = input.template ReadArray< HierarchyEdge >();
+     // an edge joins the same vertices as what it stands for, and shortcuts
+     // span edges stored before them, so unpacking ends in a path of graph
+     for( EdgeId edge_id = 0; edge_id < edges.size(); ++edge_id )
+     {
+          const auto& edge = edges[ edge_id ];
+          bool valid = edge.from < vertex_count && edge.to < vertex_count && edge.weight >= 0;
+          if( valid && edge.original != NO_EDGE )
+          {
+               valid = edge.original < graph.GetEdgeCount()
+                       && graph.GetEdge( edge.original ).from == edge.from
+                       && graph.GetEdge( edge.original ).to == edge.to;
+          }
+          else if( valid )
+          {
+               valid = edge.first < edge_id && edge.second < edge_id
+                       && edges[ edge.first ].from == edge.from
+                       && edges[ edge.first ].to == edges[ edge.second ].from
+                       && edges[ edge.second ].to == edge.to;
+          }
+          input.Expect( valid, "hierarchy edges" );
+     }
+
+     hierarchy->upward_out_ = LoadLists( input, vertex_count );
+     hierarchy->upward_in_ = LoadLists( input, vertex_count );
+     for( VertexId vertex = 0; vertex < vertex_count; ++vertex )
+     {
+          const auto leaves = [ &edges, vertex ]( EdgeId id )
+          { return id < edges.size() && edges[ id ].from == vertex; };
+          const auto enters = [ &edges, vertex ]( EdgeId id )
+          { return id < edges.size() && edges[ id ].to == vertex; };
+          input.Expect( std::all_of( std::begin( hierarchy->upward_out_[ vertex ] ), std::end( hierarchy->upward_out_[ vertex ] ), leaves )
+                        && std::all_of( std::begin( hierarchy->upward_in_[ vertex ] ), std::end( hierarchy->upward_in_[ vertex ] ), enters ),
+                        "hierarchy adjacency" );
+     }
+     return hierarchy;
+}
+
+template< typename Weight >
+size_t ContractionHierarchy< Weight >::GetShortcutCount() const
+{
+     size_t shortcut_count = 0;
+     for( const auto& edge : edges_ )
+     {
+          shortcut_count += edge.original == NO_EDGE;
+     }
+     return shortcut_count;
+}
+
+}
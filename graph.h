@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <cstdlib>
-#include <deque>
+#include <iterator>
 #include <vector>
 
 template< typename It >
@@ -40,40 +43,144 @@ struct Edge
      Weight weight;
 };
 
+// Edge as stored in the compressed sparse row layout of a frozen graph
+template< typename Weight >
+struct IncidentEdge
+{
+     EdgeId id;
+     VertexId to;
+     Weight weight;
+};
+
+// Ids of the edges leaving a vertex, read either from an incidence list
+// or from the ids stored in the compressed sparse row array
+template< typename Weight >
+class IncidentEdgeIdIterator
+{
+public:
+     using iterator_category = std::forward_iterator_tag;
+     using value_type = EdgeId;
+     using difference_type = std::ptrdiff_t;
+     using pointer = const EdgeId*;
+     using reference = const EdgeId&;
+
+     IncidentEdgeIdIterator() = default;
+
+     explicit IncidentEdgeIdIterator( const EdgeId* id )
+               : id_( id )
+     {}
+
+     explicit IncidentEdgeIdIterator( const IncidentEdge< Weight >* edge )
+               : edge_( edge )
+     {}
+
+     reference operator*() const
+     { return edge_ ? edge_->id : *id_; }
+
+     IncidentEdgeIdIterator& operator++()
+     {
+          if( edge_ )
+          {
+               ++edge_;
+          }
+          else
+          {
+               ++id_;
+          }
+          return *this;
+     }
+
+     IncidentEdgeIdIterator operator++( int )
+     {
+          IncidentEdgeIdIterator result = *this;
+          ++*this;
+          return result;
+     }
+
+     bool operator==( const IncidentEdgeIdIterator& other ) const
+     { return id_ == other.id_ && edge_ == other.edge_; }
+
+     bool operator!=( const IncidentEdgeIdIterator& other ) const
+     { return !( *this == other ); }
+
+private:
+     const EdgeId* id_ = nullptr;
+     const IncidentEdge< Weight >* edge_ = nullptr;
+};
+
 template< typename Weight >
 class DirectedWeightedGraph
 {
 private:
      using IncidenceList = std::vector< EdgeId >;
-     using IncidentEdgesRange = Range< typename IncidenceList::const_iterator >;
+     using IncidentEdgesRange = Range< IncidentEdgeIdIterator< Weight > >;
+     using OutgoingEdgesRange = Range< typename std::vector< IncidentEdge< Weight > >::const_iterator >;
 
 public:
      DirectedWeightedGraph( size_t vertex_count );
 
+     VertexId AddVertex();
+
      EdgeId AddEdge( const Edge< Weight >& edge );
 
      size_t GetVertexCount() const;
 
      size_t GetEdgeCount() const;
 
-     const Edge< Weight >& GetEdge( EdgeId edge_id ) const;
+     // a frozen graph looks the source up among the rows, O(log V)
+     Edge< Weight > GetEdge( EdgeId edge_id ) const;
 
      IncidentEdgesRange GetIncidentEdges( VertexId vertex ) const;
 
+     // Packs edges into one contiguous array sorted by source, which then
+     // holds their only copy; adding an edge afterwards unfreezes the graph
+     void Freeze();
+
+     bool IsFrozen() const;
+
+     // Frozen graph only: edges leaving vertex with target and weight inlined
+     OutgoingEdgesRange GetOutgoingEdges( VertexId vertex ) const;
+
 private:
-     std::vector< Edge< Weight>> edges_;
+     void Unfreeze();
+
+     size_t vertex_count_;
+     // not frozen only
+     std::vector< Edge< Weight > > edges_;
      std::vector< IncidenceList > incidence_lists_;
+
+     // frozen only: rows of csr_edges_ by source, and where each edge id is
+     bool frozen_ = false;
+     std::vector< size_t > offsets_;
+     std::vector< IncidentEdge< Weight > > csr_edges_;
+     std::vector< size_t > csr_positions_;
 };
 
 
 template< typename Weight >
 DirectedWeightedGraph< Weight >::DirectedWeightedGraph( size_t vertex_count )
-          : incidence_lists_( vertex_count )
+          : vertex_count_( vertex_count )
+          , incidence_lists_( vertex_count )
 {}
 
+template< typename Weight >
+VertexId DirectedWeightedGraph< Weight >::AddVertex()
+{
+     if( frozen_ )
+     {
+          Unfreeze();
+     }
+     incidence_lists_.emplace_back();
+     return vertex_count_++;
+}
+
 template< typename Weight >
 EdgeId DirectedWeightedGraph< Weight >::AddEdge( const Edge< Weight >& edge )
 {
+     if( frozen_ )
+     {
+          Unfreeze();
+     }
      edges_.push_back( edge );
      const EdgeId id = edges_.size() - 1;
      incidence_lists_[ edge.from ].push_back( id );
@@ -83,26 +190,111 @@ EdgeId DirectedWeightedGraph< Weight >::AddEdge( const Edge< Weight >& edge )
 template< typename Weight >
 size_t DirectedWeightedGraph< Weight >::GetVertexCount() const
 {
-     return incidence_lists_.size();
+     return vertex_count_;
 }
 
 template< typename Weight >
 size_t DirectedWeightedGraph< Weight >::GetEdgeCount() const
 {
-     return edges_.size();
+     return frozen_ ? csr_edges_.size() : edges_.size();
 }
 
 template< typename Weight >
-const Edge< Weight >& DirectedWeightedGraph< Weight >::GetEdge( EdgeId edge_id ) const
+Edge< Weight > DirectedWeightedGraph< Weight >::GetEdge( EdgeId edge_id ) const
 {
-     return edges_[ edge_id ];
+     if( !frozen_ )
+     {
+          return edges_[ edge_id ];
+     }
+     const size_t position = csr_positions_[ edge_id ];
+     const auto row = std::upper_bound( std::begin( offsets_ ), std::end( offsets_ ), position );
+     const VertexId from = std::distance( std::begin( offsets_ ), row ) - 1;
+     const auto& edge = csr_edges_[ position ];
+     return { from, edge.to, edge.weight };
 }
 
 template< typename Weight >
 typename DirectedWeightedGraph< Weight >::IncidentEdgesRange
 DirectedWeightedGraph< Weight >::GetIncidentEdges( VertexId vertex ) const
 {
+     using Iterator = IncidentEdgeIdIterator< Weight >;
+     if( frozen_ )
+     {
+          return { Iterator( csr_edges_.data() + offsets_[ vertex ] ),
+                   Iterator( csr_edges_.data() + offsets_[ vertex + 1 ] ) };
+     }
      const auto& edges = incidence_lists_[ vertex ];
-     return { std::begin( edges ), std::end( edges ) };
+     return { Iterator( edges.data() ), Iterator( edges.data() + edges.size() ) };
+}
+
+template< typename Weight >
+void DirectedWeightedGraph< Weight >::Freeze()
+{
+     if( frozen_ )
+     {
+          return;
+     }
+     offsets_.assign( vertex_count_ + 1, 0 );
+     for( const auto& edge : edges_ )
+     {
+          ++offsets_[ edge.from + 1 ];
+     }
+     for( VertexId vertex = 0; vertex < vertex_count_; ++vertex )
+     {
+          offsets_[ vertex + 1 ] += offsets_[ vertex ];
+     }
+
+     csr_edges_.resize( edges_.size() );
+     csr_positions_.resize( edges_.size() );
+     for( VertexId vertex = 0; vertex < vertex_count_; ++vertex )
+     {
+          size_t position = offsets_[ vertex ];
+          for( const EdgeId edge_id : incidence_lists_[ vertex ] )
+          {
+               const auto& edge = edges_[ edge_id ];
+               csr_edges_[ position ] = { edge_id, edge.to, edge.weight };
+               csr_positions_[ edge_id ] = position;
+               ++position;
+          }
+     }
+
+     edges_ = std::vector< Edge< Weight > >();
+     incidence_lists_ = std::vector< IncidenceList >();
+     frozen_ = true;
+}
+
+template< typename Weight >
+void DirectedWeightedGraph< Weight >::Unfreeze()
+{
+     edges_.resize( csr_edges_.size() );
+     incidence_lists_.resize( vertex_count_ );
+     for( VertexId vertex = 0; vertex < vertex_count_; ++vertex )
+     {
+          for( size_t position = offsets_[ vertex ]; position < offsets_[ vertex + 1 ]; ++position )
+          {
+               const auto& edge = csr_edges_[ position ];
+               edges_[ edge.id ] = { vertex, edge.to, edge.weight };
+               incidence_lists_[ vertex ].push_back( edge.id );
+          }
+     }
+     offsets_ = std::vector< size_t >();
+     csr_edges_ = std::vector< IncidentEdge< Weight > >();
+     csr_positions_ = std::vector< size_t >();
+     frozen_ = false;
+}
+
+template< typename Weight >
+bool DirectedWeightedGraph< Weight >::IsFrozen() const
+{
+     return frozen_;
+}
+
+template< typename Weight >
+typename DirectedWeightedGraph< Weight >::OutgoingEdgesRange
+DirectedWeightedGraph< Weight >::GetOutgoingEdges( VertexId vertex ) const
+{
+     assert( frozen_ );
+     return { std::next( std::begin( csr_edges_ ), offsets_[ vertex ] ),
+              std::next( std::begin( csr_edges_ ), offsets_[ vertex + 1 ] ) };
 }
 }
@@ -1,4 +1,12 @@
-#include <iomanip>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
 #include "json.h"
 
 using namespace std;
@@ -11,98 +19,418 @@ Document::Document( Node root )
 {
 }
 
+Document::Document( Node root, unique_ptr< pmr::monotonic_buffer_resource > arena )
+          : arena( move( arena ) )
+          , root( move( root ) )
+{
+}
+
 const Node& Document::GetRoot() const
 {
      return root;
 }
 
-Node LoadNode( istream& input );
+namespace
+{
 
-Node LoadArray( istream& input )
+// Scans a contiguous buffer, pos never passes end
+struct Cursor
 {
-     vector< Node > result;
+     const char* pos;
+     const char* end;
+     // containers of the loaded tree are allocated here
+     pmr::memory_resource* resource;
 
-     for( char c; input >> c && c != ']'; )
+     bool AtEnd() const
      {
-          if( c != ',' )
+          return pos == end;
+     }
+
+     char Peek() const
+     {
+          return pos == end ? '\0' : *pos;
+     }
+
+     void SkipSpaces()
+     {
+          while( pos != end && ( *pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t' ) )
           {
-               input.putback( c );
+               ++pos;
           }
-          result.push_back( LoadNode( input ) );
      }
 
-     return Node( move( result ) );
+     // next non-space character, '\0' at the end of input
+     char Next()
+     {
+          SkipSpaces();
+          return pos == end ? '\0' : *pos++;
+     }
+};
+
+bool IsDigit( char c )
+{
+     return c >= '0' && c <= '9';
 }
 
-Node LoadNumber( istream& input )
+// Finds the closing quote of a string literal body starting at pos, or
+// returns nullptr if the input ends first. pos is left where scanning can
+// resume once more input arrives. Runs without escapes are skipped by memchr
+const char* FindStringEnd( const char*& pos, const char* end, bool& hasEscapes )
 {
-     bool negative = false;
-     if( input.peek() == '-' )
+     while( true )
      {
-          negative = true;
-          input.get();
+          const char* quote = static_cast< const char* >( memchr( pos, '"', end - pos ) );
+          if( !quote )
+          {
+               quote = end;
+          }
+          const char* slash = static_cast< const char* >( memchr( pos, '\\', quote - pos ) );
+          if( !slash )
+          {
+               pos = quote;
+               return quote == end ? nullptr : quote;
+          }
+          hasEscapes = true;
+          if( end - slash < 2 )
+          {
+               pos = slash;
+               return nullptr;
+          }
+          pos = slash + 2;
      }
-     int num = 0;
-     while( isdigit( input.peek() ) )
+}
+
+int HexValue( char c )
+{
+     if( IsDigit( c ) )
+     {
+          return c - '0';
+     }
+     if( c >= 'a' && c <= 'f' )
+     {
+          return c - 'a' + 10;
+     }
+     if( c >= 'A' && c <= 'F' )
+     {
+          return c - 'A' + 10;
+     }
+     return -1;
+}
+
+// code unit of a \uXXXX escape whose hex digits start at text, -1 if malformed
+int32_t ReadCodeUnit( string_view text )
+{
+     if( text.size() < 4 )
+     {
+          return -1;
+     }
+     int32_t result = 0;
+     for( size_t i = 0; i < 4; ++i )
+     {
+          const int digit = HexValue( text[ i ] );
+          if( digit < 0 )
+          {
+               return -1;
+          }
+          result = result * 16 + digit;
+     }
+     return result;
+}
+
+void AppendUtf8( string& out, uint32_t codePoint )
+{
+     if( codePoint < 0x80 )
+     {
+          out.push_back( static_cast< char >( codePoint ) );
+     }
+     else if( codePoint < 0x800 )
+     {
+          out.push_back( static_cast< char >( 0xC0 | codePoint >> 6 ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint & 0x3F ) ) );
+     }
+     else if( codePoint < 0x10000 )
+     {
+          out.push_back( static_cast< char >( 0xE0 | codePoint >> 12 ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint >> 6 & 0x3F ) ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint & 0x3F ) ) );
+     }
+     else
+     {
+          out.push_back( static_cast< char >( 0xF0 | codePoint >> 18 ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint >> 12 & 0x3F ) ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint >> 6 & 0x3F ) ) );
+          out.push_back( static_cast< char >( 0x80 | ( codePoint & 0x3F ) ) );
+     }
+}
+
+// Decodes a string literal body into out. Unpaired surrogates and malformed
+// \u escapes become U+FFFD, unknown escapes keep the escaped character
+void DecodeString( string_view raw, string& out )
+{
+     constexpr uint32_t Replacement = 0xFFFD;
+     out.clear();
+     while( true )
+     {
+          const size_t slash = raw.find( '\\' );
+          out.append( raw.substr( 0, slash ) );
+          if( slash == string_view::npos || slash + 1 == raw.size() )
+          {
+               return;
+          }
+          const char escape = raw[ slash + 1 ];
+          raw.remove_prefix( slash + 2 );
+          switch( escape )
+          {
+               case 'b':
+                    out.push_back( '\b' );
+                    break;
+               case 'f':
+                    out.push_back( '\f' );
+                    break;
+               case 'n':
+                    out.push_back( '\n' );
+                    break;
+               case 'r':
+                    out.push_back( '\r' );
+                    break;
+               case 't':
+                    out.push_back( '\t' );
+                    break;
+               case 'u':
+               {
+                    int32_t unit = ReadCodeUnit( raw );
+                    if( unit < 0 )
+                    {
+                         AppendUtf8( out, Replacement );
+                         break;
+                    }
+                    raw.remove_prefix( 4 );
+                    uint32_t codePoint = unit;
+                    if( unit >= 0xD800 && unit <= 0xDBFF )
+                    {
+                         const int32_t low = raw.size() >= 2 && raw[ 0 ] == '\\' && raw[ 1 ] == 'u' ? ReadCodeUnit( raw.substr( 2 ) ) : -1;
+                         if( low >= 0xDC00 && low <= 0xDFFF )
+                         {
+                              codePoint = 0x10000 + ( ( unit - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+                              raw.remove_prefix( 6 );
+                         }
+                         else
+                         {
+                              codePoint = Replacement;
+                         }
+                    }
+                    else if( unit >= 0xDC00 && unit <= 0xDFFF )
+                    {
+                         codePoint = Replacement;
+                    }
+                    AppendUtf8( out, codePoint );
+               }
+                    break;
+               default:
+                    out.push_back( escape );
+                    break;
+          }
+     }
+}
+
+// raw itself when it has no escapes, otherwise its decoded copy in scratch
+string_view DecodedView( string_view raw, bool hasEscapes, string& scratch )
+{
+     if( !hasEscapes )
+     {
+          return raw;
+     }
+     DecodeString( raw, scratch );
+     return scratch;
+}
+
+// Offset of the first character of value that must be escaped: quote,
+// backslash or a control character
+size_t FindEscapeNeeded( string_view value )
+{
+     size_t pos = 0;
+#if defined( __SSE2__ )
+     const __m128i quote = _mm_set1_epi8( '"' );
+     const __m128i slash = _mm_set1_epi8( '\\' );
+     const __m128i control = _mm_set1_epi8( 0x1F );
+     for( ; pos + 16 <= value.size(); pos += 16 )
+     {
+          const __m128i chunk = _mm_loadu_si128( reinterpret_cast< const __m128i* >( value.data() + pos ) );
+          // max( c, 0x1F ) == 0x1F only for c <= 0x1F
+          const __m128i special = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( chunk, quote ), _mm_cmpeq_epi8( chunk, slash ) ),
+                                                _mm_cmpeq_epi8( _mm_max_epu8( chunk, control ), control ) );
+          if( const int mask = _mm_movemask_epi8( special ) )
+          {
+               return pos + __builtin_ctz( mask );
+          }
+     }
+#endif
+     for( ; pos < value.size(); ++pos )
+     {
+          const unsigned char c = value[ pos ];
+          if( c == '"' || c == '\\' || c < 0x20 )
+          {
+               return pos;
+          }
+     }
+     return value.size();
+}
+
+// Passes value to sink as a JSON string literal, escape-free runs in one piece
+template< typename Sink >
+void EncodeString( string_view value, Sink&& sink )
+{
+     sink( string_view( "\"" ) );
+     while( true )
+     {
+          const size_t pos = FindEscapeNeeded( value );
+          sink( value.substr( 0, pos ) );
+          if( pos == value.size() )
+          {
+               break;
+          }
+          const unsigned char c = value[ pos ];
+          switch( c )
+          {
+               case '"':
+                    sink( string_view( "\\\"" ) );
+                    break;
+               case '\\':
+                    sink( string_view( "\\\\" ) );
+                    break;
+               case '\b':
+                    sink( string_view( "\\b" ) );
+                    break;
+               case '\f':
+                    sink( string_view( "\\f" ) );
+                    break;
+               case '\n':
+                    sink( string_view( "\\n" ) );
+                    break;
+               case '\r':
+                    sink( string_view( "\\r" ) );
+                    break;
+               case '\t':
+                    sink( string_view( "\\t" ) );
+                    break;
+               default:
+               {
+                    static const char hex[] = "0123456789abcdef";
+                    const char escaped[] = { '\\', 'u', '0', '0', hex[ c >> 4 ], hex[ c & 0xF ] };
+                    sink( string_view( escaped, sizeof( escaped ) ) );
+               }
+                    break;
+          }
+          value.remove_prefix( pos + 1 );
+     }
+     sink( string_view( "\"" ) );
+}
+
+// Loaders and the parser throw this where the input ends instead of a value
+[[noreturn]] void ThrowUnexpectedEnd()
+{
+     throw invalid_argument( "Json::Load: unexpected end of input" );
+}
+
+Node LoadNode( Cursor& input );
+
+Node LoadArray( Cursor& input )
+{
+     Array result( input.resource );
+
+     for( char c; ( c = input.Next() ) != '\0' && c != ']'; )
      {
-          num *= 10;
-          num += input.get() - '0';
+          if( c != ',' )
+          {
+               --input.pos;
+          }
+          result.push_back( LoadNode( input ) );
      }
-     if( input.peek() != '.' )
+
+     return Node( move( result ) );
+}
+
+// Integer unless the literal has a fraction or an exponent or does not fit
+// in int64_t. Doubles are correctly rounded by from_chars
+variant< int64_t, double > ReadNumber( Cursor& input )
+{
+     const char* begin = input.pos;
+     const char* it = begin + ( input.Peek() == '-' );
+     while( it != input.end && IsDigit( *it ) )
      {
-          return Node( num * ( negative? -1: 1 ) );
+          ++it;
      }
-     input.get();
-     double result = num;
-     double mul = 1;
-     while( isdigit( input.peek() ) )
+     if( it == input.end || ( *it != '.' && *it != 'e' && *it != 'E' ) )
      {
-          mul /= 10;
-          result += ( input.get() - '0' ) * mul;
+          int64_t num = 0;
+          if( const auto [ ptr, ec ] = from_chars( begin, it, num ); ec == errc() )
+          {
+               input.pos = ptr;
+               return num;
+          }
      }
-     return Node( result * ( negative? -1: 1 ) );
+     double result = 0;
+     const char* ptr = from_chars( begin, input.end, result ).ptr;
+     // malformed literals are skipped rather than re-read forever
+     input.pos = max( ptr, it );
+     return result;
+}
+
+Node LoadNumber( Cursor& input )
+{
+     return visit( []( auto value ) { return Node( value ); }, ReadNumber( input ) );
+}
+
+// Reads up to and past the closing quote, decoding into scratch only if needed
+string_view LoadStringView( Cursor& input, string& scratch )
+{
+     const char* begin = input.pos;
+     bool hasEscapes = false;
+     const char* quote = FindStringEnd( input.pos, input.end, hasEscapes );
+     const char* end = quote ? quote : input.end;
+     input.pos = quote ? quote + 1 : input.end;
+     return DecodedView( string_view( begin, end - begin ), hasEscapes, scratch );
 }
 
-Node LoadString( istream& input )
+Node LoadString( Cursor& input )
 {
-     string line;
-     getline( input, line, '"' );
-     return Node( move( line ) );
+     string scratch;
+     return Node( String( LoadStringView( input, scratch ), input.resource ) );
 }
 
-Node LoadDict( istream& input )
+Node LoadDict( Cursor& input )
 {
-     map< string, Node > result;
+     Object result( input.resource );
 
-     for( char c; input >> c && c != '}'; )
+     for( char c; ( c = input.Next() ) != '\0' && c != '}'; )
      {
           if( c == ',' )
           {
-               input >> c;
+               input.Next();
           }
 
-          string key = LoadString( input ).AsString();
-          input >> c;
-          result.emplace( move( key ), LoadNode( input ) );
+          string scratch;
+          string_view key = LoadStringView( input, scratch );
+          input.Next();
+          result.emplace( key, LoadNode( input ) );
      }
 
      return Node( move( result ) );
 }
 
-Node LoadBool( istream& input )
+Node LoadBool( Cursor& input )
 {
-     string res;
-     while( isalpha( input.peek() ) )
+     const char* begin = input.pos;
+     while( input.pos != input.end && isalpha( static_cast< unsigned char >( *input.pos ) ) )
      {
-          res.push_back( input.get() );
+          ++input.pos;
      }
-     return Node( res == "true" );
+     return Node( string_view( begin, input.pos - begin ) == "true" );
 }
 
-Node LoadNode( istream& input )
+Node LoadNode( Cursor& input )
 {
-     char c;
-     input >> c;
+     char c = input.Next();
 
      if( c == '[' )
      {
@@ -118,24 +446,733 @@ Node LoadNode( istream& input )
      }
      else if( c == 't' || c == 'f' )
      {
-          input.putback( c );
+          --input.pos;
           return LoadBool( input );
      }
-     else if( isdigit( c ) || c == '-' )
+     else if( IsDigit( c ) || c == '-' )
      {
-          input.putback( c );
+          --input.pos;
           return LoadNumber( input );
      }
+     else if( c == '\0' )
+     {
+          ThrowUnexpectedEnd();
+     }
      else
      {
-          input.putback( c );
+          --input.pos;
           return LoadString( input );
      }
 }
 
-Document Load( istream& input )
+// Stage one of the indexed parse: classifies 64-byte blocks into bitmasks
+// and collects offsets of structural characters outside strings, of every
+// unescaped quote and of the first byte of each bare scalar.
+struct BlockMasks
+{
+     uint64_t quote = 0;
+     uint64_t backslash = 0;
+     uint64_t space = 0;
+     uint64_t op = 0;
+};
+
+constexpr size_t BlockSize = 64;
+
+#if defined( __AVX2__ )
+
+uint64_t Match32( __m256i chunk, char c )
+{
+     return static_cast< uint32_t >( _mm256_movemask_epi8( _mm256_cmpeq_epi8( chunk, _mm256_set1_epi8( c ) ) ) );
+}
+
+BlockMasks ClassifyBlock( const char* block )
+{
+     BlockMasks masks;
+     for( size_t shift = 0; shift < BlockSize; shift += 32 )
+     {
+          const __m256i chunk = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( block + shift ) );
+          masks.quote |= Match32( chunk, '"' ) << shift;
+          masks.backslash |= Match32( chunk, '\\' ) << shift;
+          masks.space |= ( Match32( chunk, ' ' ) | Match32( chunk, '\n' ) | Match32( chunk, '\r' ) | Match32( chunk, '\t' ) ) << shift;
+          masks.op |= ( Match32( chunk, '{' ) | Match32( chunk, '}' ) | Match32( chunk, '[' ) | Match32( chunk, ']' )
+                        | Match32( chunk, ':' ) | Match32( chunk, ',' ) ) << shift;
+     }
+     return masks;
+}
+
+#elif defined( __SSE2__ )
+
+uint64_t Match16( __m128i chunk, char c )
+{
+     return static_cast< uint32_t >( _mm_movemask_epi8( _mm_cmpeq_epi8( chunk, _mm_set1_epi8( c ) ) ) );
+}
+
+BlockMasks ClassifyBlock( const char* block )
+{
+     BlockMasks masks;
+     for( size_t shift = 0; shift < BlockSize; shift += 16 )
+     {
+          const __m128i chunk = _mm_loadu_si128( reinterpret_cast< const __m128i* >( block + shift ) );
+          masks.quote |= Match16( chunk, '"' ) << shift;
+          masks.backslash |= Match16( chunk, '\\' ) << shift;
+          masks.space |= ( Match16( chunk, ' ' ) | Match16( chunk, '\n' ) | Match16( chunk, '\r' ) | Match16( chunk, '\t' ) ) << shift;
+          masks.op |= ( Match16( chunk, '{' ) | Match16( chunk, '}' ) | Match16( chunk, '[' ) | Match16( chunk, ']' )
+                        | Match16( chunk, ':' ) | Match16( chunk, ',' ) ) << shift;
+     }
+     return masks;
+}
+
+#else
+
+BlockMasks ClassifyBlock( const char* block )
+{
+     BlockMasks masks;
+     for( size_t i = 0; i < BlockSize; ++i )
+     {
+          const uint64_t bit = uint64_t( 1 ) << i;
+          switch( block[ i ] )
+          {
+               case '"':
+                    masks.quote |= bit;
+                    break;
+               case '\\':
+                    masks.backslash |= bit;
+                    break;
+               case ' ': case '\n': case '\r': case '\t':
+                    masks.space |= bit;
+                    break;
+               case '{': case '}': case '[': case ']': case ':': case ',':
+                    masks.op |= bit;
+                    break;
+               default:
+                    break;
+          }
+     }
+     return masks;
+}
+
+#endif
+
+// bit i of the result is the xor of bits 0..i of x
+uint64_t PrefixXor( uint64_t x )
+{
+     x ^= x << 1;
+     x ^= x << 2;
+     x ^= x << 4;
+     x ^= x << 8;
+     x ^= x << 16;
+     x ^= x << 32;
+     return x;
+}
+
+class StructuralIndexer
+{
+public:
+     explicit StructuralIndexer( vector< uint32_t >& index )
+               : index_( index )
+     {
+     }
+
+     void Block( const char* block, uint32_t offset )
+     {
+          const BlockMasks masks = ClassifyBlock( block );
+
+          // backslashes are rare, so escapes are resolved bit by bit
+          uint64_t escaped = escapeCarry_;
+          escapeCarry_ = 0;
+          for( uint64_t bits = masks.backslash; bits != 0; bits &= bits - 1 )
+          {
+               const size_t pos = __builtin_ctzll( bits );
+               if( escaped >> pos & 1 )
+               {
+                    continue;
+               }
+               if( pos == BlockSize - 1 )
+               {
+                    escapeCarry_ = 1;
+               }
+               else
+               {
+                    escaped |= uint64_t( 1 ) << ( pos + 1 );
+               }
+          }
+
+          const uint64_t quote = masks.quote & ~escaped;
+          const uint64_t inString = PrefixXor( quote ) ^ stringCarry_;
+          stringCarry_ = static_cast< uint64_t >( static_cast< int64_t >( inString ) >> 63 );
+
+          const uint64_t scalar = ~( masks.space | masks.op | quote | inString );
+          const uint64_t scalarStart = scalar & ~( scalar << 1 | scalarCarry_ );
+          scalarCarry_ = scalar >> 63;
+
+          Flush( ( masks.op & ~inString ) | quote | scalarStart, offset );
+     }
+
+private:
+     void Flush( uint64_t bits, uint32_t offset )
+     {
+          for( ; bits != 0; bits &= bits - 1 )
+          {
+               index_.push_back( offset + __builtin_ctzll( bits ) );
+          }
+     }
+
+     vector< uint32_t >& index_;
+     uint64_t escapeCarry_ = 0;
+     uint64_t stringCarry_ = 0;
+     uint64_t scalarCarry_ = 0;
+};
+
+vector< uint32_t > BuildStructuralIndex( string_view input )
+{
+     vector< uint32_t > index;
+     index.reserve( input.size() / 8 );
+     StructuralIndexer indexer( index );
+
+     size_t offset = 0;
+     for( ; offset + BlockSize <= input.size(); offset += BlockSize )
+     {
+          indexer.Block( input.data() + offset, offset );
+     }
+     if( offset < input.size() )
+     {
+          char tail[ BlockSize ];
+          memset( tail, ' ', BlockSize );
+          memcpy( tail, input.data() + offset, input.size() - offset );
+          indexer.Block( tail, offset );
+     }
+     return index;
+}
+
+// Stage two: builds the tree walking the structural index
+class IndexedLoader
+{
+public:
+     IndexedLoader( string_view input, const vector< uint32_t >& index, pmr::memory_resource* resource )
+               : input_( input )
+               , index_( index )
+               , resource_( resource )
+     {
+     }
+
+     Node LoadNode()
+     {
+          if( pos_ >= index_.size() )
+          {
+               ThrowUnexpectedEnd();
+          }
+          switch( Current() )
+          {
+               case '[':
+                    return LoadArray();
+               case '{':
+                    return LoadDict();
+               case '"':
+               {
+                    string scratch;
+                    return Node( String( LoadStringView( scratch ), resource_ ) );
+               }
+               default:
+                    return LoadScalar();
+          }
+     }
+
+private:
+     char Current() const
+     {
+          return pos_ < index_.size() ? input_[ index_[ pos_ ] ] : '\0';
+     }
+
+     Node LoadArray()
+     {
+          Array result( resource_ );
+          ++pos_;
+          while( pos_ < index_.size() && Current() != ']' )
+          {
+               result.push_back( LoadNode() );
+               if( Current() == ',' )
+               {
+                    ++pos_;
+               }
+          }
+          ++pos_;
+          return Node( move( result ) );
+     }
+
+     Node LoadDict()
+     {
+          Object result( resource_ );
+          ++pos_;
+          while( pos_ < index_.size() && Current() != '}' )
+          {
+               string scratch;
+               string_view key = LoadStringView( scratch );
+               ++pos_;
+               result.emplace( key, LoadNode() );
+               if( Current() == ',' )
+               {
+                    ++pos_;
+               }
+          }
+          ++pos_;
+          return Node( move( result ) );
+     }
+
+     // the closing quote is the next index entry
+     string_view LoadStringView( string& scratch )
+     {
+          if( pos_ >= index_.size() )
+          {
+               ThrowUnexpectedEnd();
+          }
+          const size_t begin = index_[ pos_ ] + 1;
+          const size_t end = pos_ + 1 < index_.size() ? index_[ pos_ + 1 ] : input_.size();
+          pos_ += 2;
+          const string_view raw = input_.substr( begin, end - begin );
+          return DecodedView( raw, raw.find( '\\' ) != string_view::npos, scratch );
+     }
+
+     Node LoadScalar()
+     {
+          if( pos_ >= index_.size() )
+          {
+               ThrowUnexpectedEnd();
+          }
+          const char* begin = input_.data() + index_[ pos_++ ];
+          const char* end = pos_ < index_.size() ? input_.data() + index_[ pos_ ] : input_.data() + input_.size();
+          Cursor cursor { begin, end, resource_ };
+          const char c = *begin;
+          if( c == 't' || c == 'f' )
+          {
+               return LoadBool( cursor );
+          }
+          else if( IsDigit( c ) || c == '-' )
+          {
+               return LoadNumber( cursor );
+          }
+          while( end != begin && ( end[ -1 ] == ' ' || end[ -1 ] == '\n' || end[ -1 ] == '\r' || end[ -1 ] == '\t' ) )
+          {
+               --end;
+          }
+          return Node( String( begin, end, resource_ ) );
+     }
+
+     string_view input_;
+     const vector< uint32_t >& index_;
+     pmr::memory_resource* resource_;
+     size_t pos_ = 0;
+};
+
+// Emits Handler events, reading the stream in chunks. Only the token
+// being scanned is kept, so memory does not depend on the input size
+class SaxParser
+{
+public:
+     SaxParser( istream& input, Handler& handler )
+               : input_( &input )
+               , handler_( handler )
+     {
+          storage_.resize( ChunkSize );
+          data_ = storage_.data();
+     }
+
+     SaxParser( string_view input, Handler& handler )
+               : handler_( handler )
+               , data_( input.data() )
+               , size_( input.size() )
+     {
+     }
+
+     void ParseValue()
+     {
+          const char c = Next();
+          if( c == '{' )
+          {
+               ParseObject();
+          }
+          else if( c == '[' )
+          {
+               ParseArray();
+          }
+          else if( c == '"' )
+          {
+               handler_.Value( ReadString() );
+          }
+          else if( c == 't' || c == 'f' )
+          {
+               --pos_;
+               handler_.Value( Scan( []( char ch ) { return isalpha( static_cast< unsigned char >( ch ) ) != 0; } ) == "true" );
+          }
+          else if( IsDigit( c ) || c == '-' )
+          {
+               --pos_;
+               const string_view token = Scan( []( char ch ) { return IsDigit( ch ) || ch == '-' || ch == '+' || ch == '.' || ch == 'e' || ch == 'E'; } );
+               Cursor cursor { token.data(), token.data() + token.size(), nullptr };
+               visit( [ this ]( auto value ) { handler_.Value( value ); }, ReadNumber( cursor ) );
+          }
+          else if( c == '\0' )
+          {
+               ThrowUnexpectedEnd();
+          }
+          else
+          {
+               --pos_;
+               handler_.Value( ReadString() );
+          }
+     }
+
+private:
+     static constexpr size_t ChunkSize = 1 << 16;
+
+     void ParseObject()
+     {
+          handler_.StartObject();
+          char c;
+          while( ( c = Next() ) != '\0' && c != '}' )
+          {
+               if( c == ',' )
+               {
+                    Next();
+               }
+               handler_.Key( ReadString() );
+               Next();
+               ParseValue();
+          }
+          if( c == '\0' )
+          {
+               ThrowUnexpectedEnd();
+          }
+          handler_.EndObject();
+     }
+
+     void ParseArray()
+     {
+          handler_.StartArray();
+          char c;
+          while( ( c = Next() ) != '\0' && c != ']' )
+          {
+               if( c != ',' )
+               {
+                    --pos_;
+               }
+               ParseValue();
+          }
+          if( c == '\0' )
+          {
+               ThrowUnexpectedEnd();
+          }
+          handler_.EndArray();
+     }
+
+     // next non-space character, '\0' at the end of input
+     char Next()
+     {
+          while( true )
+          {
+               while( pos_ != size_ && ( data_[ pos_ ] == ' ' || data_[ pos_ ] == '\n' || data_[ pos_ ] == '\r' || data_[ pos_ ] == '\t' ) )
+               {
+                    ++pos_;
+               }
+               if( pos_ != size_ )
+               {
+                    return data_[ pos_++ ];
+               }
+               if( !Refill() )
+               {
+                    return '\0';
+               }
+          }
+     }
+
+     // longest run of characters matching pred, valid until the next read
+     template< typename Pred >
+     string_view Scan( Pred pred )
+     {
+          size_t start = pos_;
+          while( true )
+          {
+               while( pos_ != size_ && pred( data_[ pos_ ] ) )
+               {
+                    ++pos_;
+               }
+               if( pos_ != size_ )
+               {
+                    break;
+               }
+               const size_t scanned = pos_ - start;
+               pos_ = start;
+               const bool more = Refill();
+               start = pos_;
+               pos_ = start + scanned;
+               if( !more )
+               {
+                    break;
+               }
+          }
+          return string_view( data_ + start, pos_ - start );
+     }
+
+     // decoded string body, valid until the next read
+     string_view ReadString()
+     {
+          size_t start = pos_;
+          bool hasEscapes = false;
+          const char* quote = nullptr;
+          while( true )
+          {
+               const char* scan = data_ + pos_;
+               quote = FindStringEnd( scan, data_ + size_, hasEscapes );
+               pos_ = scan - data_;
+               if( quote )
+               {
+                    break;
+               }
+               const size_t scanned = pos_ - start;
+               pos_ = start;
+               const bool more = Refill();
+               start = pos_;
+               pos_ = start + scanned;
+               if( !more )
+               {
+                    break;
+               }
+          }
+          const size_t end = quote ? quote - data_ : size_;
+          pos_ = quote ? end + 1 : size_;
+          return DecodedView( string_view( data_ + start, end - start ), hasEscapes, scratch_ );
+     }
+
+     // keeps the unread tail [pos_, size_) and appends the next chunk after it
+     bool Refill()
+     {
+          if( !input_ || !*input_ )
+          {
+               return false;
+          }
+          const size_t tail = size_ - pos_;
+          memmove( storage_.data(), storage_.data() + pos_, tail );
+          if( storage_.size() - tail < ChunkSize )
+          {
+               storage_.resize( tail + ChunkSize );
+          }
+          input_->read( storage_.data() + tail, storage_.size() - tail );
+          data_ = storage_.data();
+          pos_ = 0;
+          size_ = tail + input_->gcount();
+          return input_->gcount() > 0;
+     }
+
+     istream* input_ = nullptr;
+     Handler& handler_;
+     string storage_;
+     string scratch_;
+     const char* data_ = nullptr;
+     size_t pos_ = 0;
+     size_t size_ = 0;
+};
+
+}
+
+void Parse( string_view input, Handler& handler )
+{
+     SaxParser( input, handler ).ParseValue();
+}
+
+void Parse( istream& input, Handler& handler )
+{
+     SaxParser( input, handler ).ParseValue();
+}
+
+Document Load( string_view input, ParseMode mode )
+{
+     // first block sized after the input, the tree is usually of the same order
+     auto arena = make_unique< pmr::monotonic_buffer_resource >( max< size_t >( input.size(), 4096 ) );
+     // roots are initialized in place: moving a String node out of a local
+     // variant makes GCC 12 warn about maybe-uninitialized string storage
+     if( mode == ParseMode::Indexed && input.size() <= numeric_limits< uint32_t >::max() )
+     {
+          const vector< uint32_t > index = BuildStructuralIndex( input );
+          IndexedLoader loader( input, index, arena.get() );
+          return Document( loader.LoadNode(), move( arena ) );
+     }
+     Cursor cursor { input.data(), input.data() + input.size(), arena.get() };
+     return Document( LoadNode( cursor ), move( arena ) );
+}
+
+Document Load( istream& input, ParseMode mode )
+{
+     // bulk reads instead of a virtual call per character
+     string buffer;
+     char chunk[ 1 << 16 ];
+     while( input.read( chunk, sizeof( chunk ) ) || input.gcount() > 0 )
+     {
+          buffer.append( chunk, input.gcount() );
+     }
+     return Load( string_view( buffer ), mode );
+}
+
+namespace
+{
+
+constexpr size_t WriterFlushSize = 1 << 16;
+
+}
+
+char* FormatNumber( char* out, int value )
+{
+     return to_chars( out, out + MaxNumberChars, value ).ptr;
+}
+
+char* FormatNumber( char* out, int64_t value )
+{
+     return to_chars( out, out + MaxNumberChars, value ).ptr;
+}
+
+char* FormatNumber( char* out, double value, NumberFormat format )
+{
+     if( format.mode == NumberFormat::Shortest )
+     {
+          return to_chars( out, out + MaxNumberChars, value ).ptr;
+     }
+     // general format is printf %.*g, which is what streams use for the default float field
+     const int precision = clamp( format.precision, 1, MaxNumberPrecision );
+     return to_chars( out, out + MaxNumberChars, value, chars_format::general, precision ).ptr;
+}
+
+Writer::Writer( ostream& output, NumberFormat format )
+          : output_( output )
+          , format_( format )
+{
+     buffer_.reserve( WriterFlushSize * 2 );
+}
+
+Writer::~Writer()
+{
+     Flush();
+}
+
+Writer& Writer::BeginObject()
+{
+     Separate();
+     Put( '{' );
+     first_ = true;
+     return *this;
+}
+
+Writer& Writer::Key( string_view key )
+{
+     Value( key );
+     Put( ':' );
+     first_ = true;
+     return *this;
+}
+
+Writer& Writer::EndObject()
+{
+     Put( '}' );
+     first_ = false;
+     return *this;
+}
+
+Writer& Writer::BeginArray()
+{
+     Separate();
+     Put( '[' );
+     first_ = true;
+     return *this;
+}
+
+Writer& Writer::EndArray()
+{
+     Put( ']' );
+     first_ = false;
+     return *this;
+}
+
+Writer& Writer::Value( int value )
+{
+     return Value( static_cast< int64_t >( value ) );
+}
+
+Writer& Writer::Value( int64_t value )
+{
+     Separate();
+     char chars[ MaxNumberChars ];
+     Put( string_view( chars, FormatNumber( chars, value ) - chars ) );
+     return *this;
+}
+
+Writer& Writer::Value( double value )
+{
+     Separate();
+     char chars[ MaxNumberChars ];
+     Put( string_view( chars, FormatNumber( chars, value, format_ ) - chars ) );
+     return *this;
+}
+
+Writer& Writer::Value( bool value )
+{
+     Separate();
+     Put( value ? "true" : "false" );
+     return *this;
+}
+
+Writer& Writer::Value( string_view value )
+{
+     Separate();
+     EncodeString( value, [ this ]( string_view chunk ) { Put( chunk ); } );
+     return *this;
+}
+
+Writer& Writer::Raw( string_view json )
+{
+     Separate();
+     Put( json );
+     return *this;
+}
+
+void Writer::Flush()
+{
+     output_.write( buffer_.data(), buffer_.size() );
+     buffer_.clear();
+}
+
+void Writer::Reset()
+{
+     buffer_.clear();
+     first_ = true;
+}
+
+void Writer::Separate()
+{
+     if( !first_ )
+     {
+          Put( ',' );
+     }
+     first_ = false;
+}
+
+void Writer::Put( char c )
+{
+     buffer_.push_back( c );
+     if( buffer_.size() >= WriterFlushSize )
+     {
+          Flush();
+     }
+}
+
+void Writer::Put( string_view chars )
+{
+     buffer_.append( chars );
+     if( buffer_.size() >= WriterFlushSize )
+     {
+          Flush();
+     }
+}
+
+void PrintString( ostream& os, string_view value )
 {
-     return Document { LoadNode( input ) };
+     EncodeString( value, [ &os ]( string_view chunk ) { os.write( chunk.data(), chunk.size() ); } );
 }
 
 void Save( const Document& doc, std::ostream& output )
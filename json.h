@@ -1,44 +1,173 @@
 #pragma once
 
+#include <cstdint>
 #include <istream>
-#include <map>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <stdexcept>
+#include <utility>
 #include <variant>
 #include <vector>
-#include <iomanip>
 
 namespace Json
 {
 
+class Node;
+
+// How doubles are printed. Precision gives the same text as
+// std::setprecision( precision ) in the default float format, Shortest gives
+// the shortest text that reads back to the same value
+struct NumberFormat
+{
+     enum Mode
+     {
+          Precision,
+          Shortest
+     };
+
+     Mode mode = Precision;
+     int precision = 6;
+};
+
+// Enough for any integer and for doubles at the largest supported precision
+constexpr size_t MaxNumberChars = 128;
+constexpr int MaxNumberPrecision = 100;
+
+// Locale-independent formatting into out[ 0, MaxNumberChars ), returns the end of the text
+char* FormatNumber( char* out, int value );
+
+char* FormatNumber( char* out, int64_t value );
+
+char* FormatNumber( char* out, double value, NumberFormat format = {} );
+
+// Writes value as a JSON string literal: quotes, backslashes and control
+// characters are escaped, other bytes including UTF-8 are copied as is
+void PrintString( std::ostream& os, std::string_view value );
+
+// Containers draw memory from a polymorphic resource: the new/delete one by
+// default, the Document arena for loaded trees
+using Array = std::pmr::vector< Node >;
+using String = std::pmr::string;
+
+// Members kept in insertion order in a flat array. Requests and responses
+// carry a handful of keys, so lookup is a linear scan
+class Object
+{
+public:
+     using value_type = std::pair< String, Node >;
+     using Items = std::pmr::vector< value_type >;
+     using iterator = Items::iterator;
+     using const_iterator = Items::const_iterator;
+     using allocator_type = Items::allocator_type;
+
+     Object() = default;
+
+     explicit Object( const allocator_type& allocator )
+               : items_( allocator )
+     {
+     }
+
+     Node& operator[]( std::string_view key );
+
+     const Node& at( std::string_view key ) const;
+
+     iterator find( std::string_view key );
+
+     const_iterator find( std::string_view key ) const;
+
+     // keeps the existing value if key is already present
+     std::pair< iterator, bool > emplace( std::string_view key, Node value );
+
+     iterator begin()
+     {
+          return items_.begin();
+     }
+
+     iterator end()
+     {
+          return items_.end();
+     }
+
+     const_iterator begin() const
+     {
+          return items_.begin();
+     }
+
+     const_iterator end() const
+     {
+          return items_.end();
+     }
+
+     size_t size() const
+     {
+          return items_.size();
+     }
+
+     bool empty() const
+     {
+          return items_.empty();
+     }
+
+     void reserve( size_t size )
+     {
+          items_.reserve( size );
+     }
+
+     allocator_type get_allocator() const
+     {
+          return items_.get_allocator();
+     }
+
+private:
+     Items items_;
+};
+
 class Node
-          : std::variant< std::vector< Node >,
-                    std::map< std::string, Node >,
-                    int,
-                    std::string,
+          : std::variant< Array,
+                    Object,
+                    int64_t,
+                    String,
                     double,
                     bool >
 {
 public:
      using variant::variant;
 
+     Node( std::string_view value )
+               : variant( String( value ) )
+     {
+     }
+
+     Node( const std::string& value )
+               : Node( std::string_view( value ) )
+     {
+     }
+
      const auto& AsArray() const
      {
-          return std::get< std::vector< Node>>( *this );
+          return std::get< Array >( *this );
      }
 
      const auto& AsMap() const
      {
-          return std::get< std::map< std::string, Node>>( *this );
+          return std::get< Object >( *this );
      }
 
      int AsInt() const
      {
-          return std::get< int >( *this );
+          return static_cast< int >( std::get< int64_t >( *this ) );
+     }
+
+     int64_t AsInt64() const
+     {
+          return std::get< int64_t >( *this );
      }
 
      const auto& AsString() const
      {
-          return std::get< std::string >( *this );
+          return std::get< String >( *this );
      }
 
      double AsDouble() const
@@ -47,7 +176,7 @@ public:
           {
                return *res;
           }
-          return std::get< int >( *this );
+          return static_cast< double >( std::get< int64_t >( *this ) );
      }
 
      bool AsBool() const
@@ -55,9 +184,9 @@ public:
           return std::get< bool >( *this );
      }
 
-     void Print( std::ostream& os ) const
+     void Print( std::ostream& os, NumberFormat format = {} ) const
      {
-          if( auto res = std::get_if< std::vector< Node > >( this ))
+          if( auto res = std::get_if< Array >( this ))
           {
                os << '[';
                bool first = true;
@@ -71,11 +200,11 @@ public:
                     {
                          os << ',';
                     }
-                    item.Print( os );
+                    item.Print( os, format );
                }
                os << ']';
           }
-          else if( auto res = std::get_if< std::map< std::string, Node > >( this ) )
+          else if( auto res = std::get_if< Object >( this ) )
           {
                os << '{';
                bool first = true;
@@ -89,42 +218,196 @@ public:
                     {
                          os << ',';
                     }
-                    os << std::quoted( key ) << ':';
-                    item.Print( os );
+                    PrintString( os, key );
+                    os << ':';
+                    item.Print( os, format );
                }
                os << '}';
           }
-          else if( auto res = std::get_if< int >( this ) )
+          else if( auto res = std::get_if< int64_t >( this ) )
           {
-               os << *res;
+               char chars[ MaxNumberChars ];
+               os.write( chars, FormatNumber( chars, *res ) - chars );
           }
-          else if( auto res = std::get_if< std::string >( this ) )
+          else if( auto res = std::get_if< String >( this ) )
           {
-               os << std::quoted( *res );
+               PrintString( os, *res );
           }
           else if( auto res = std::get_if< double >( this ) )
           {
-               os << std::setprecision( 6 ) << *res;
+               char chars[ MaxNumberChars ];
+               os.write( chars, FormatNumber( chars, *res, format ) - chars );
           }
           else if( auto res = std::get_if< bool >( this ) )
           {
-               os << std::boolalpha << *res;
+               os << ( *res ? "true" : "false" );
           }
      }
 };
 
+inline Object::iterator Object::find( std::string_view key )
+{
+     auto it = items_.begin();
+     while( it != items_.end() && it->first != key )
+     {
+          ++it;
+     }
+     return it;
+}
+
+inline Object::const_iterator Object::find( std::string_view key ) const
+{
+     auto it = items_.begin();
+     while( it != items_.end() && it->first != key )
+     {
+          ++it;
+     }
+     return it;
+}
+
+inline const Node& Object::at( std::string_view key ) const
+{
+     auto it = find( key );
+     if( it == items_.end() )
+     {
+          throw std::out_of_range( "Json::Object::at" );
+     }
+     return it->second;
+}
+
+inline std::pair< Object::iterator, bool > Object::emplace( std::string_view key, Node value )
+{
+     if( auto it = find( key ); it != items_.end() )
+     {
+          return { it, false };
+     }
+     items_.emplace_back( key, std::move( value ) );
+     return { std::prev( items_.end() ), true };
+}
+
+inline Node& Object::operator[]( std::string_view key )
+{
+     return emplace( key, Node() ).first->second;
+}
+
 class Document
 {
 public:
      explicit Document( Node root );
 
+     // root must be allocated from arena, the whole tree is released with it
+     Document( Node root, std::unique_ptr< std::pmr::monotonic_buffer_resource > arena );
+
      const Node& GetRoot() const;
 
 private:
+     std::unique_ptr< std::pmr::monotonic_buffer_resource > arena;
      Node root;
 };
 
-Document Load( std::istream& input );
+enum class ParseMode
+{
+     // single pass with a pointer cursor
+     Sequential,
+     // SIMD pass builds an index of structural characters, then the tree is built from it
+     Indexed
+};
+
+// Parses a document held in a contiguous buffer. Throws std::invalid_argument
+// if the input ends where a value is expected
+Document Load( std::string_view input, ParseMode mode = ParseMode::Sequential );
+
+Document Load( std::istream& input, ParseMode mode = ParseMode::Sequential );
+
+// Receives values of a document in order without building a tree.
+// Views passed in are valid only for the duration of the call
+class Handler
+{
+public:
+     virtual ~Handler() = default;
+
+     virtual void StartObject() = 0;
+
+     virtual void Key( std::string_view key ) = 0;
+
+     virtual void EndObject() = 0;
+
+     virtual void StartArray() = 0;
+
+     virtual void EndArray() = 0;
+
+     virtual void Value( int64_t value ) = 0;
+
+     virtual void Value( double value ) = 0;
+
+     virtual void Value( bool value ) = 0;
+
+     virtual void Value( std::string_view value ) = 0;
+};
+
+// Throws std::invalid_argument if the input ends before the value is complete
+void Parse( std::string_view input, Handler& handler );
+
+// Reads the stream in fixed-size chunks, memory stays bounded by the longest token
+void Parse( std::istream& input, Handler& handler );
+
+// Serializes values as they are produced, in the same format as Node::Print.
+// Output is collected in a buffer and handed to the stream in large chunks
+class Writer
+{
+public:
+     explicit Writer( std::ostream& output, NumberFormat format = {} );
+
+     ~Writer();
+
+     Writer& BeginObject();
+
+     Writer& Key( std::string_view key );
+
+     Writer& EndObject();
+
+     Writer& BeginArray();
+
+     Writer& EndArray();
+
+     Writer& Value( int value );
+
+     Writer& Value( int64_t value );
+
+     Writer& Value( double value );
+
+     Writer& Value( bool value );
+
+     Writer& Value( std::string_view value );
+
+     // literals would otherwise convert to bool
+     Writer& Value( const char* value )
+     {
+          return Value( std::string_view( value ) );
+     }
+
+     // already serialized values, written as the next item(s) of the container
+     Writer& Raw( std::string_view json );
+
+     void Flush();
+
+     // drops output not flushed yet and starts over with a new top-level
+     // value, so one writer and its buffer serve a sequence of documents
+     void Reset();
+
+private:
+     void Separate();
+
+     void Put( char c );
+
+     void Put( std::string_view chars );
+
+     std::ostream& output_;
+     NumberFormat format_;
+     std::string buffer_;
+     // no comma before the first item of a container or after a key
+     bool first_ = true;
+};
 
 void Save( const Document& doc, std::ostream& output );
 
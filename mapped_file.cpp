@@ -0,0 +1,61 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace transport
+{
+
+MappedFile::MappedFile( const std::string& path )
+{
+     const int fd = open( path.c_str(), O_RDONLY );
+     if( fd < 0 )
+     {
+          throw std::system_error( errno, std::generic_category(), "open " + path );
+     }
+
+     struct stat info {};
+     if( fstat( fd, &info ) != 0 )
+     {
+          const int error = errno;
+          close( fd );
+          throw std::system_error( error, std::generic_category(), "stat " + path );
+     }
+
+     size_ = static_cast< size_t >( info.st_size );
+     // an empty mapping is not allowed, an empty file is just an empty view
+     if( size_ != 0 )
+     {
+          data_ = mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0 );
+          if( data_ == MAP_FAILED )
+          {
+               const int error = errno;
+               close( fd );
+               data_ = nullptr;
+               throw std::system_error( error, std::generic_category(), "mmap " + path );
+          }
+          madvise( data_, size_, MADV_SEQUENTIAL );
+     }
+     // the mapping keeps its own reference to the file
+     close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+     if( data_ )
+     {
+          munmap( data_, size_ );
+     }
+}
+
+std::string_view MappedFile::Data() const
+{
+     return { static_cast< const char* >( data_ ), size_ };
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef YANDEX_BROWN_COURSE_MAPPED_FILE_H
+#define YANDEX_BROWN_COURSE_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace transport
+{
+
+// Whole file mapped read-only, the view stays valid while the object lives.
+// Pages are read ahead sequentially straight from the page cache
+class MappedFile
+{
+public:
+     // throws std::system_error if the file can't be opened or mapped
+     explicit MappedFile( const std::string& path );
+
+     ~MappedFile();
+
+     MappedFile( const MappedFile& ) = delete;
+
+     MappedFile& operator=( const MappedFile& ) = delete;
+
+     std::string_view Data() const;
+
+private:
+     void* data_ = nullptr;
+     size_t size_ = 0;
+};
+
+}
+
+#endif
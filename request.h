@@ -3,17 +3,45 @@
 
 #include "transport.h"
 
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace Json
 {
 
 class Node;
 
+class Writer;
+
 }
 
 
 namespace transport
 {
 
+// Members of one request object collected from parse events
+struct RequestFields
+{
+     std::string type;
+     std::string name;
+     std::string from;
+     std::string to;
+     double latitude = 0;
+     double longitude = 0;
+     std::vector< std::pair< std::string, unsigned int >> roadDistances;
+     std::vector< std::string > stops;
+     bool isRoundtrip = false;
+     int id = 0;
+
+     // routing_settings
+     int busWaitTime = 0;
+     int busVelocity = 0;
+     int routerThreads = 0;
+     std::string routingMode;
+     int statThreads = 0;
+};
+
 struct Request
 {
      enum Type
@@ -30,6 +58,8 @@ struct Request
 
      virtual void ParsingFrom( const Json::Node& request ) = 0;
 
+     virtual void ParsingFrom( RequestFields&& fields ) = 0;
+
      Type type;
 };
 
@@ -52,7 +82,11 @@ struct GetRequest
                : Request( Request::Get )
      {}
 
-     virtual Json::Node Process( Transport& transport ) const = 0;
+     // writes the response object
+     virtual void Process( Transport& transport, Json::Writer& writer ) const = 0;
+
+     // same response, for requests answered concurrently on a frozen Transport
+     virtual void Process( Transport::Reader& reader, Json::Writer& writer ) const = 0;
 
      int id = 0;
 };
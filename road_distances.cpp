@@ -0,0 +1,133 @@
+#include "road_distances.h"
+#include "snapshot.h"
+
+#include <utility>
+
+namespace transport
+{
+
+uint64_t RoadDistances::MakeKey( StopId from, StopId to )
+{
+     return ( static_cast< uint64_t >( from ) << 32u ) | to;
+}
+
+size_t RoadDistances::FindSlot( uint64_t key ) const
+{
+     const size_t mask = slots_.size() - 1;
+     // multiplicative hashing spreads the packed ids over the table
+     size_t idx = static_cast< size_t >( ( key * 0x9E3779B97F4A7C15ull ) >> 32u ) & mask;
+     while( slots_[ idx ].key != EMPTY && slots_[ idx ].key != key )
+     {
+          idx = ( idx + 1 ) & mask;
+     }
+     return idx;
+}
+
+void RoadDistances::Grow()
+{
+     std::vector< Slot > old = std::move( slots_ );
+     slots_.assign( old.empty() ? 64 : old.size() * 2, Slot{} );
+     for( const Slot& slot: old )
+     {
+          if( slot.key != EMPTY )
+          {
+               slots_[ FindSlot( slot.key ) ] = slot;
+          }
+     }
+}
+
+void RoadDistances::Set( StopId from, StopId to, unsigned int length )
+{
+     if( ( size_ + 1 ) * 2 > slots_.size() )
+     {
+          Grow();
+     }
+     const uint64_t key = MakeKey( from, to );
+     Slot& slot = slots_[ FindSlot( key ) ];
+     if( slot.key == EMPTY )
+     {
+          slot.key = key;
+          ++size_;
+     }
+     slot.length = length;
+}
+
+void RoadDistances::SetIfAbsent( StopId from, StopId to, unsigned int length )
+{
+     if( !Find( from, to ).has_value() )
+     {
+          Set( from, to, length );
+     }
+}
+
+std::optional< unsigned int > RoadDistances::Find( StopId from, StopId to ) const
+{
+     if( slots_.empty() )
+     {
+          return std::nullopt;
+     }
+     const Slot& slot = slots_[ FindSlot( MakeKey( from, to ) ) ];
+     if( slot.key == EMPTY )
+     {
+          return std::nullopt;
+     }
+     return slot.length;
+}
+
+std::vector< std::optional< unsigned int > > RoadDistances::FindAlong( const std::vector< StopId >& path ) const
+{
+     std::vector< std::optional< unsigned int > > lengths;
+     if( path.size() < 2 )
+     {
+          return lengths;
+     }
+     lengths.reserve( path.size() - 1 );
+     for( size_t idx = 0; idx + 1 < path.size(); ++idx )
+     {
+          lengths.push_back( Find( path[ idx ], path[ idx + 1 ] ) );
+     }
+     return lengths;
+}
+
+size_t RoadDistances::Size() const
+{
+     return size_;
+}
+
+// Slot has tail padding, so keys and lengths go to separate arrays
+void RoadDistances::Save( SnapshotWriter& output ) const
+{
+     std::vector< uint64_t > keys;
+     std::vector< unsigned int > lengths;
+     keys.reserve( slots_.size() );
+     lengths.reserve( slots_.size() );
+     for( const Slot& slot: slots_ )
+     {
+          keys.push_back( slot.key );
+          lengths.push_back( slot.length );
+     }
+     output.WriteArray( keys );
+     output.WriteArray( lengths );
+     output.Write< uint64_t >( size_ );
+}
+
+RoadDistances RoadDistances::Load( SnapshotReader& input )
+{
+     const auto keys = input.ReadArray< uint64_t >();
+     const auto lengths = input.ReadArray< unsigned int >();
+     input.Expect( keys.size() == lengths.size(), "road distances" );
+     // probing needs a power of two table that is never full
+     input.Expect( ( keys.size() & ( keys.size() - 1 ) ) == 0, "road distances table size" );
+     RoadDistances distances;
+     distances.slots_.resize( keys.size() );
+     for( size_t idx = 0; idx < keys.size(); ++idx )
+     {
+          distances.slots_[ idx ] = Slot { keys[ idx ], lengths[ idx ] };
+          distances.size_ += keys[ idx ] != EMPTY;
+     }
+     input.Expect( input.Read< uint64_t >() == distances.size_ && distances.size_ * 2 <= keys.size(),
+                   "road distances count" );
+     return distances;
+}
+
+}
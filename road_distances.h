@@ -0,0 +1,60 @@
+#ifndef YANDEX_BROWN_COURSE_ROAD_DISTANCES_H
+#define YANDEX_BROWN_COURSE_ROAD_DISTANCES_H
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace transport
+{
+
+class SnapshotWriter;
+
+class SnapshotReader;
+
+// Road distances between stop ids in one open-addressing table keyed by
+// the (from, to) pair, linear probing over a power of two capacity
+class RoadDistances
+{
+public:
+     using StopId = uint32_t;
+
+     void Set( StopId from, StopId to, unsigned int length );
+
+     // keeps an already known distance
+     void SetIfAbsent( StopId from, StopId to, unsigned int length );
+
+     std::optional< unsigned int > Find( StopId from, StopId to ) const;
+
+     // Distances between neighbouring stops of the path, nullopt for unknown ones
+     std::vector< std::optional< unsigned int > > FindAlong( const std::vector< StopId >& path ) const;
+
+     size_t Size() const;
+
+     // the table is written slot by slot, loading does no rehashing
+     void Save( SnapshotWriter& output ) const;
+
+     static RoadDistances Load( SnapshotReader& input );
+
+private:
+     static constexpr uint64_t EMPTY = UINT64_MAX;
+
+     struct Slot
+     {
+          uint64_t key = EMPTY;
+          unsigned int length = 0;
+     };
+
+     static uint64_t MakeKey( StopId from, StopId to );
+
+     size_t FindSlot( uint64_t key ) const;
+
+     void Grow();
+
+     std::vector< Slot > slots_;
+     size_t size_ = 0;
+};
+
+}
+
+#endif
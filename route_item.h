@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <memory>
+#include <string_view>
 #include <utility>
 #include "json.h"
 
@@ -27,7 +28,7 @@ public:
 
      virtual ~RouteItem() = default;
 
-     virtual Json::Node GetItemInfo() const = 0;
+     virtual void WriteItemInfo( Json::Writer& writer ) const = 0;
 
 protected:
      double time_;
@@ -44,22 +45,23 @@ class WaitItem
 public:
      ~WaitItem() override = default;
 
-     WaitItem( std::string stopName, double waitTime )
+     WaitItem( std::string_view stopName, double waitTime )
                : RouteItem( Wait, waitTime )
-               , stopName_( std::move( stopName ) )
+               , stopName_( stopName )
      {}
 
-     Json::Node GetItemInfo() const override
+     void WriteItemInfo( Json::Writer& writer ) const override
      {
-          std::map< std::string, Json::Node > result;
-          result[ "type" ] = std::string( "Wait");
-          result[ "stop_name" ] = stopName_;
-          result[ "time" ] = time_;
-          return Json::Node( result );
+          writer.BeginObject();
+          writer.Key( "type" ).Value( "Wait" );
+          writer.Key( "stop_name" ).Value( stopName_ );
+          writer.Key( "time" ).Value( time_ );
+          writer.EndObject();
      }
 
 private:
-     std::string stopName_;
+     // owned by the Transport the route was built by
+     std::string_view stopName_;
 };
 
 class BusItem
@@ -68,24 +70,30 @@ class BusItem
 public:
      ~BusItem() override = default;
 
-     BusItem( std::string busName, int spanCount, double time )
+     BusItem( std::string_view busName, int spanCount, double time )
                : RouteItem( Bus, time )
-               , busName_( std::move( busName ) )
+               , busName_( busName )
                , spanCount_( spanCount )
      {}
 
-     Json::Node GetItemInfo() const override
+     void AddSpan( double time )
      {
-          std::map< std::string, Json::Node > result;
-          result[ "type" ] = std::string( "Bus" );
-          result[ "bus" ] = busName_;
-          result[ "span_count" ] = spanCount_;
-          result[ "time" ] = time_;
-          return Json::Node( result );
+          ++spanCount_;
+          time_ += time;
+     }
+
+     void WriteItemInfo( Json::Writer& writer ) const override
+     {
+          writer.BeginObject();
+          writer.Key( "type" ).Value( "Bus" );
+          writer.Key( "bus" ).Value( busName_ );
+          writer.Key( "span_count" ).Value( spanCount_ );
+          writer.Key( "time" ).Value( time_ );
+          writer.EndObject();
      }
 
 private:
-     std::string busName_;
+     std::string_view busName_;
      int spanCount_;
 };
 
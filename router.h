@@ -3,10 +3,17 @@
 #include "graph.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
 #include <optional>
+#include <queue>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -21,142 +28,400 @@ private:
      using Graph = DirectedWeightedGraph< Weight >;
 
 public:
-     Router( const Graph& graph );
+     static constexpr size_t DEFAULT_TREE_CACHE_SIZE = 256;
 
-     using RouteId = uint64_t;
+     // tree_cache_size bounds how many single-source trees are kept (LRU)
+     explicit Router( const Graph& graph, size_t tree_cache_size = DEFAULT_TREE_CACHE_SIZE );
 
-     struct RouteInfo
+     // Returns the route weight and puts its edges into edges, whose storage
+     // is reused across calls; nullopt if to is unreachable from from
+     std::optional< Weight > FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges ) const;
+
+     class Reader;
+
+     struct CacheStats
      {
-          RouteId id;
-          Weight weight;
-          size_t edge_count;
+          size_t hits;
+          size_t misses;
+          size_t size;
      };
 
-     std::optional< RouteInfo > BuildRoute( VertexId from, VertexId to ) const;
+     CacheStats GetCacheStats() const;
+
+     // Builds trees for the given sources on thread_count threads and puts
+     // them into the cache; sources beyond the cache capacity are skipped
+     void Precompute( const std::vector< VertexId >& sources, size_t thread_count );
+
+     // Must be called after edges leaving the given vertices were added to the
+     // graph: drops cached trees that reach any of them. Trees of other sources
+     // stay valid, vertices added to the graph later are unreachable from them.
+     void InvalidateTreesReaching( const std::vector< VertexId >& vertices );
 
-     EdgeId GetRouteEdge( RouteId route_id, size_t edge_idx ) const;
+     // Writes the cache capacity and the cached trees to output
+     template< typename Output >
+     void Save( Output& output ) const;
 
-     void ReleaseRoute( RouteId route_id );
+     // Router over graph with the trees written by Save, graph must be the
+     // one the saved router was built on. Trees that don't fit graph are
+     // reported through input.Expect( valid, what ), which has to throw
+     template< typename Input >
+     static std::unique_ptr< Router > Load( const Graph& graph, Input& input );
 
 private:
      const Graph& graph_;
 
-     struct RouteInternalData
+     // Shortest-path tree of a single source in structure-of-arrays form,
+     // indexed by target vertex. Unreachable vertices hold UNREACHABLE weight
+     // and the source and unreachable vertices hold NO_EDGE.
+     static constexpr EdgeId NO_EDGE = std::numeric_limits< EdgeId >::max();
+     static constexpr Weight UNREACHABLE = std::numeric_limits< Weight >::has_infinity
+                                           ? std::numeric_limits< Weight >::infinity()
+                                           : std::numeric_limits< Weight >::max();
+
+     struct RoutesInternalData
      {
-          Weight weight;
-          std::optional< EdgeId > prev_edge;
+          std::vector< Weight > weights;
+          std::vector< EdgeId > prev_edges;
      };
-     using RoutesInternalData = std::vector< std::vector< std::optional< RouteInternalData>> >;
-
-     using ExpandedRoute = std::vector< EdgeId >;
-     mutable RouteId next_route_id_ = 0;
-     mutable std::unordered_map< RouteId, ExpandedRoute > expanded_routes_cache_;
 
-     void InitializeRoutesInternalData( const Graph& graph )
+     // LRU of single-source trees, most recently used at front
+     class TreeCache
      {
-          const size_t vertex_count = graph.GetVertexCount();
-          for( VertexId vertex = 0; vertex < vertex_count; ++vertex )
+     public:
+          explicit TreeCache( size_t capacity )
+                    : capacity_( capacity )
+          {}
+
+          // marks the tree as most recently used
+          const RoutesInternalData* Find( VertexId from )
+          {
+               auto it = index_.find( from );
+               if( it == index_.end() )
+               {
+                    return nullptr;
+               }
+               trees_.splice( trees_.begin(), trees_, it->second );
+               return &it->second->second;
+          }
+
+          // leaves the order alone, so concurrent readers may call it
+          const RoutesInternalData* Peek( VertexId from ) const
+          {
+               auto it = index_.find( from );
+               return it == index_.end() ? nullptr : &it->second->second;
+          }
+
+          const RoutesInternalData& Put( VertexId from, RoutesInternalData routes_internal_data )
           {
-               routes_internal_data_[ vertex ][ vertex ] = RouteInternalData { 0, std::nullopt };
-               for( const EdgeId edge_id : graph.GetIncidentEdges( vertex ) )
+               if( trees_.size() >= capacity_ )
                {
-                    const auto& edge = graph.GetEdge( edge_id );
-                    assert( edge.weight >= 0 );
-                    auto& route_internal_data = routes_internal_data_[ vertex ][ edge.to ];
-                    if( !route_internal_data || route_internal_data->weight > edge.weight )
+                    index_.erase( trees_.back().first );
+                    trees_.pop_back();
+               }
+               trees_.emplace_front( from, std::move( routes_internal_data ) );
+               index_[ from ] = trees_.begin();
+               return trees_.front().second;
+          }
+
+          template< typename Predicate >
+          void EraseIf( Predicate predicate )
+          {
+               for( auto it = trees_.begin(); it != trees_.end(); )
+               {
+                    if( predicate( it->second ) )
+                    {
+                         index_.erase( it->first );
+                         it = trees_.erase( it );
+                    }
+                    else
                     {
-                         route_internal_data = RouteInternalData { edge.weight, edge_id };
+                         ++it;
                     }
                }
           }
+
+          size_t Capacity() const
+          {
+               return capacity_;
+          }
+
+          size_t Size() const
+          {
+               return trees_.size();
+          }
+
+          template< typename Function >
+          void ForEachOldestFirst( Function function ) const
+          {
+               for( auto it = trees_.rbegin(); it != trees_.rend(); ++it )
+               {
+                    function( it->first, it->second );
+               }
+          }
+
+     private:
+          using TreeList = std::list< std::pair< VertexId, RoutesInternalData > >;
+          size_t capacity_;
+          TreeList trees_;
+          std::unordered_map< VertexId, typename TreeList::iterator > index_;
+     };
+
+     mutable TreeCache tree_cache_;
+     mutable size_t tree_cache_hits_ = 0;
+     mutable size_t tree_cache_misses_ = 0;
+
+     const RoutesInternalData& GetRoutesInternalData( VertexId from ) const
+     {
+          if( const RoutesInternalData* routes_internal_data = tree_cache_.Find( from ) )
+          {
+               ++tree_cache_hits_;
+               return *routes_internal_data;
+          }
+          ++tree_cache_misses_;
+          return tree_cache_.Put( from, BuildRoutesInternalData( from ) );
      }
 
-     void RelaxRoute( VertexId vertex_from, VertexId vertex_to,
-                      const RouteInternalData& route_from, const RouteInternalData& route_to )
+     std::optional< Weight > ExpandRoute( const RoutesInternalData& routes_internal_data, VertexId to,
+                                          std::vector< EdgeId >& edges ) const
      {
-          auto& route_relaxing = routes_internal_data_[ vertex_from ][ vertex_to ];
-          const Weight candidate_weight = route_from.weight + route_to.weight;
-          if( !route_relaxing || candidate_weight < route_relaxing->weight )
-          {
-               route_relaxing = {
-                         candidate_weight,
-                         route_to.prev_edge
-                         ? route_to.prev_edge
-                         : route_from.prev_edge
-               };
+          edges.clear();
+          if( to >= routes_internal_data.weights.size() )
+          {
+               return std::nullopt;
           }
+          const Weight weight = routes_internal_data.weights[ to ];
+          if( weight == UNREACHABLE )
+          {
+               return std::nullopt;
+          }
+          for( EdgeId edge_id = routes_internal_data.prev_edges[ to ];
+               edge_id != NO_EDGE;
+               edge_id = routes_internal_data.prev_edges[ graph_.GetEdge( edge_id ).from ] )
+          {
+               edges.push_back( edge_id );
+          }
+          std::reverse( std::begin( edges ), std::end( edges ) );
+          return weight;
      }
 
-     void RelaxRoutesInternalDataThroughVertex( size_t vertex_count, VertexId vertex_through )
+     // Dijkstra with a binary heap, O((V + E) log V) per source
+     RoutesInternalData BuildRoutesInternalData( VertexId from ) const
      {
-          for( VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from )
+          const size_t vertex_count = graph_.GetVertexCount();
+          RoutesInternalData routes_internal_data { std::vector< Weight >( vertex_count, UNREACHABLE ),
+                                                    std::vector< EdgeId >( vertex_count, NO_EDGE ) };
+          auto& weights = routes_internal_data.weights;
+          auto& prev_edges = routes_internal_data.prev_edges;
+
+          using QueueItem = std::pair< Weight, VertexId >;
+          std::priority_queue< QueueItem, std::vector< QueueItem >, std::greater<> > queue;
+
+          weights[ from ] = 0;
+          queue.push( { 0, from } );
+          while( !queue.empty() )
           {
-               if( const auto& route_from = routes_internal_data_[ vertex_from ][ vertex_through ] )
+               const auto [ weight, vertex ] = queue.top();
+               queue.pop();
+               if( weights[ vertex ] < weight )
                {
-                    for( VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to )
+                    continue;
+               }
+               auto relax = [ &, weight = weight ]( EdgeId edge_id, VertexId to, Weight edge_weight )
+               {
+                    assert( edge_weight >= 0 );
+                    const Weight candidate_weight = weight + edge_weight;
+                    if( candidate_weight < weights[ to ] )
+                    {
+                         weights[ to ] = candidate_weight;
+                         prev_edges[ to ] = edge_id;
+                         queue.push( { candidate_weight, to } );
+                    }
+               };
+               if( graph_.IsFrozen() )
+               {
+                    for( const auto& edge : graph_.GetOutgoingEdges( vertex ) )
                     {
-                         if( const auto& route_to = routes_internal_data_[ vertex_through ][ vertex_to ] )
-                         {
-                              RelaxRoute( vertex_from, vertex_to, *route_from, *route_to );
-                         }
+                         relax( edge.id, edge.to, edge.weight );
                     }
+                    continue;
+               }
+               for( const EdgeId edge_id : graph_.GetIncidentEdges( vertex ) )
+               {
+                    const auto& edge = graph_.GetEdge( edge_id );
+                    relax( edge_id, edge.to, edge.weight );
                }
           }
+          return routes_internal_data;
      }
-
-     RoutesInternalData routes_internal_data_;
 };
 
-
+// Query state of one thread. Readers only read the router, so any number of
+// them may run at once while the router and its graph are left unchanged.
+// Trees precomputed into the router are shared, others are cached per reader
 template< typename Weight >
-Router< Weight >::Router( const Graph& graph )
-          : graph_( graph )
-          , routes_internal_data_( graph.GetVertexCount(),
-                                   std::vector< std::optional< RouteInternalData>>( graph.GetVertexCount() ) )
+class Router< Weight >::Reader
 {
-     InitializeRoutesInternalData( graph );
+public:
+     explicit Reader( const Router& router )
+               : router_( router )
+               , tree_cache_( router.tree_cache_.Capacity() )
+     {}
 
-     const size_t vertex_count = graph.GetVertexCount();
-     for( VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through )
+     std::optional< Weight > FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges )
      {
-          RelaxRoutesInternalDataThroughVertex( vertex_count, vertex_through );
+          const RoutesInternalData* routes_internal_data = router_.tree_cache_.Peek( from );
+          if( !routes_internal_data )
+          {
+               routes_internal_data = tree_cache_.Find( from );
+          }
+          if( !routes_internal_data )
+          {
+               routes_internal_data = &tree_cache_.Put( from, router_.BuildRoutesInternalData( from ) );
+          }
+          return router_.ExpandRoute( *routes_internal_data, to, edges );
      }
+
+private:
+     const Router& router_;
+     TreeCache tree_cache_;
+};
+
+template< typename Weight >
+Router< Weight >::Router( const Graph& graph, size_t tree_cache_size )
+          : graph_( graph )
+          , tree_cache_( std::max< size_t >( tree_cache_size, 1 ) )
+{}
+
+template< typename Weight >
+std::optional< Weight > Router< Weight >::FindRoute( VertexId from, VertexId to, std::vector< EdgeId >& edges ) const
+{
+     return ExpandRoute( GetRoutesInternalData( from ), to, edges );
 }
 
 template< typename Weight >
-std::optional< typename Router< Weight >::RouteInfo > Router< Weight >::BuildRoute( VertexId from, VertexId to ) const
+void Router< Weight >::Precompute( const std::vector< VertexId >& sources, size_t thread_count )
 {
-     const auto& route_internal_data = routes_internal_data_[ from ][ to ];
-     if( !route_internal_data )
+     std::vector< VertexId > pending;
+     pending.reserve( std::min( sources.size(), tree_cache_.Capacity() ) );
+     for( const VertexId source : sources )
+     {
+          if( pending.size() == tree_cache_.Capacity() )
+          {
+               break;
+          }
+          if( !tree_cache_.Peek( source ) )
+          {
+               pending.push_back( source );
+          }
+     }
+
+     // Searches are independent, so threads only share the read-only graph
+     // and an index into pending; every tree gets its own output slot
+     std::vector< RoutesInternalData > trees( pending.size() );
+     std::atomic< size_t > next_source = 0;
+     auto worker = [ this, &pending, &trees, &next_source ]
+     {
+          for( size_t idx = next_source++; idx < pending.size(); idx = next_source++ )
+          {
+               trees[ idx ] = BuildRoutesInternalData( pending[ idx ] );
+          }
+     };
+
+     std::vector< std::future< void > > futures;
+     thread_count = std::clamp< size_t >( thread_count, 1, std::max< size_t >( pending.size(), 1 ) );
+     futures.reserve( thread_count - 1 );
+     for( size_t thread = 1; thread < thread_count; ++thread )
      {
-          return std::nullopt;
+          futures.push_back( std::async( std::launch::async, worker ) );
      }
-     const Weight weight = route_internal_data->weight;
-     std::vector< EdgeId > edges;
-     for( std::optional< EdgeId > edge_id = route_internal_data->prev_edge;
-          edge_id;
-          edge_id = routes_internal_data_[ from ][ graph_.GetEdge( *edge_id ).from ]->prev_edge )
+     worker();
+     for( auto& future : futures )
+     {
+          future.get();
+     }
+
+     for( size_t idx = 0; idx < pending.size(); ++idx )
      {
-          edges.push_back( *edge_id );
+          tree_cache_.Put( pending[ idx ], std::move( trees[ idx ] ) );
      }
-     std::reverse( std::begin( edges ), std::end( edges ) );
+}
 
-     const RouteId route_id = next_route_id_++;
-     const size_t route_edge_count = edges.size();
-     expanded_routes_cache_[ route_id ] = std::move( edges );
-     return RouteInfo { route_id, weight, route_edge_count };
+template< typename Weight >
+void Router< Weight >::InvalidateTreesReaching( const std::vector< VertexId >& vertices )
+{
+     tree_cache_.EraseIf( [ &vertices ]( const RoutesInternalData& routes_internal_data )
+     {
+          const auto& weights = routes_internal_data.weights;
+          return std::any_of( std::begin( vertices ), std::end( vertices ), [ &weights ]( VertexId vertex )
+          {
+               return vertex < weights.size() && weights[ vertex ] != UNREACHABLE;
+          } );
+     } );
 }
 
 template< typename Weight >
-EdgeId Router< Weight >::GetRouteEdge( RouteId route_id, size_t edge_idx ) const
+template< typename Output >
+void Router< Weight >::Save( Output& output ) const
 {
-     return expanded_routes_cache_.at( route_id )[ edge_idx ];
+     output.template Write< uint64_t >( tree_cache_.Capacity() );
+     output.template Write< uint64_t >( tree_cache_.Size() );
+     tree_cache_.ForEachOldestFirst( [ &output ]( VertexId from, const RoutesInternalData& routes_internal_data )
+     {
+          output.template Write< uint64_t >( from );
+          output.WriteArray( routes_internal_data.weights );
+          output.WriteArray( routes_internal_data.prev_edges );
+     } );
+}
+
+template< typename Weight >
+template< typename Input >
+std::unique_ptr< Router< Weight > > Router< Weight >::Load( const Graph& graph, Input& input )
+{
+     const size_t vertex_count = graph.GetVertexCount();
+     auto router = std::make_unique< Router >( graph, input.template Read< uint64_t >() );
+     const uint64_t count = input.template Read< uint64_t >();
+     input.Expect( count <= router->tree_cache_.Capacity(), "router tree count" );
+     // walk_ids[v] is the vertex whose walk towards the source reached v first
+     constexpr VertexId NOT_WALKED = std::numeric_limits< VertexId >::max();
+     std::vector< VertexId > walk_ids( vertex_count );
+     for( uint64_t idx = 0; idx < count; ++idx )
+     {
+          const VertexId from = input.template Read< uint64_t >();
+          RoutesInternalData tree { input.template ReadArray< Weight >(), input.template ReadArray< EdgeId >() };
+          input.Expect( from < vertex_count && !router->tree_cache_.Peek( from )
+                        && tree.weights.size() == vertex_count && tree.prev_edges.size() == vertex_count
+                        && tree.weights[ from ] == 0 && tree.prev_edges[ from ] == NO_EDGE,
+                        "router tree" );
+
+          // every previous edge enters its vertex, and following them from any
+          // vertex ends at the source instead of going round a cycle
+          std::fill( std::begin( walk_ids ), std::end( walk_ids ), NOT_WALKED );
+          for( VertexId start = 0; start < vertex_count; ++start )
+          {
+               for( VertexId vertex = start; walk_ids[ vertex ] == NOT_WALKED; )
+               {
+                    walk_ids[ vertex ] = start;
+                    const EdgeId edge_id = tree.prev_edges[ vertex ];
+                    if( edge_id == NO_EDGE )
+                    {
+                         input.Expect( vertex == from || tree.weights[ vertex ] == UNREACHABLE, "router tree edges" );
+                         break;
+                    }
+                    input.Expect( edge_id < graph.GetEdgeCount() && graph.GetEdge( edge_id ).to == vertex,
+                                  "router tree edges" );
+                    vertex = graph.GetEdge( edge_id ).from;
+                    input.Expect( walk_ids[ vertex ] != start, "router tree edges" );
+               }
+          }
+          router->tree_cache_.Put( from, std::move( tree ) );
+     }
+     return router;
 }
 
 template< typename Weight >
-void Router< Weight >::ReleaseRoute( RouteId route_id )
+typename Router< Weight >::CacheStats Router< Weight >::GetCacheStats() const
 {
-     expanded_routes_cache_.erase( route_id );
+     return CacheStats { tree_cache_hits_, tree_cache_misses_, tree_cache_.Size() };
 }
 
 }
@@ -0,0 +1,134 @@
+#include "snapshot.h"
+
+namespace transport
+{
+
+namespace
+{
+
+constexpr std::string_view Magic( "TRNSNAP\0", 8 );
+
+// written in native byte order, reads back differently on another one
+constexpr uint32_t ByteOrderMark = 0x01020304;
+
+struct Header
+{
+     char magic[ 8 ];
+     uint32_t version;
+     uint32_t byteOrder;
+     uint64_t layout;
+     uint64_t payloadSize;
+     uint64_t checksum;
+};
+
+// FNV-1a over 64-bit words, the tail is mixed in byte by byte
+uint64_t Checksum( std::string_view data )
+{
+     constexpr uint64_t Prime = 0x100000001b3;
+     uint64_t hash = 0xcbf29ce484222325;
+     size_t pos = 0;
+     for( ; pos + sizeof( uint64_t ) <= data.size(); pos += sizeof( uint64_t ) )
+     {
+          uint64_t word;
+          std::memcpy( &word, data.data() + pos, sizeof( word ) );
+          hash = ( hash ^ word ) * Prime;
+     }
+     for( ; pos < data.size(); ++pos )
+     {
+          hash = ( hash ^ static_cast< unsigned char >( data[ pos ] ) ) * Prime;
+     }
+     return hash;
+}
+
+}
+
+void SnapshotWriter::WriteString( std::string_view value )
+{
+     Write< uint64_t >( value.size() );
+     payload_.append( value );
+}
+
+std::string SnapshotWriter::Finish() const
+{
+     Header header {};
+     std::memcpy( header.magic, Magic.data(), Magic.size() );
+     header.version = SnapshotVersion;
+     header.byteOrder = ByteOrderMark;
+     header.layout = layout_;
+     header.payloadSize = payload_.size();
+     header.checksum = Checksum( payload_ );
+
+     std::string snapshot;
+     snapshot.reserve( sizeof( header ) + payload_.size() );
+     snapshot.append( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+     snapshot.append( payload_ );
+     return snapshot;
+}
+
+SnapshotReader::SnapshotReader( std::string_view snapshot, uint64_t layout )
+{
+     if( !IsSnapshot( snapshot ) || snapshot.size() < sizeof( Header ) )
+     {
+          throw SnapshotError( "not a snapshot" );
+     }
+     Header header;
+     std::memcpy( &header, snapshot.data(), sizeof( header ) );
+     if( header.version != SnapshotVersion )
+     {
+          throw SnapshotError( "unsupported snapshot version " + std::to_string( header.version ) );
+     }
+     if( header.byteOrder != ByteOrderMark || header.layout != layout )
+     {
+          throw SnapshotError( "snapshot was written by a build with another data layout" );
+     }
+     payload_ = snapshot.substr( sizeof( header ) );
+     if( payload_.size() != header.payloadSize )
+     {
+          throw SnapshotError( "snapshot is truncated" );
+     }
+     if( Checksum( payload_ ) != header.checksum )
+     {
+          throw SnapshotError( "snapshot checksum mismatch" );
+     }
+}
+
+bool SnapshotReader::IsSnapshot( std::string_view data )
+{
+     return data.substr( 0, Magic.size() ) == Magic;
+}
+
+std::string_view SnapshotReader::ReadString()
+{
+     const uint64_t size = Read< uint64_t >();
+     if( size > payload_.size() )
+     {
+          throw SnapshotError( "snapshot is truncated" );
+     }
+     return { Take( size ), size };
+}
+
+bool SnapshotReader::AtEnd() const
+{
+     return payload_.empty();
+}
+
+void SnapshotReader::Expect( bool valid, std::string_view what ) const
+{
+     if( !valid )
+     {
+          throw SnapshotError( "snapshot has inconsistent " + std::string( what ) );
+     }
+}
+
+const char* SnapshotReader::Take( size_t size )
+{
+     if( size > payload_.size() )
+     {
+          throw SnapshotError( "snapshot is truncated" );
+     }
+     const char* data = payload_.data();
+     payload_.remove_prefix( size );
+     return data;
+}
+
+}
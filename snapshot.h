@@ -0,0 +1,134 @@
+#ifndef YANDEX_BROWN_COURSE_SNAPSHOT_H
+#define YANDEX_BROWN_COURSE_SNAPSHOT_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace transport
+{
+
+// Binary image layout: a header with magic, format version, byte order, the
+// writer's layout fingerprint, payload size and a checksum of the payload,
+// then the payload itself. Values are stored in native byte order and sizes,
+// so a snapshot is read only by a build with the same byte order and layout
+constexpr uint32_t SnapshotVersion = 2;
+
+class SnapshotError
+          : public std::runtime_error
+{
+public:
+     using runtime_error::runtime_error;
+};
+
+// Appends values and arrays of trivially copyable types as raw bytes
+class SnapshotWriter
+{
+public:
+     // layout identifies the sizes of the types written raw, see Layout
+     explicit SnapshotWriter( uint64_t layout )
+               : layout_( layout )
+     {}
+
+     // fingerprint of type sizes, each has to be below 256
+     static constexpr uint64_t Layout( std::initializer_list< size_t > sizes )
+     {
+          uint64_t layout = 0xcbf29ce484222325;
+          for( const size_t size: sizes )
+          {
+               layout = ( layout ^ size ) * 0x100000001b3;
+          }
+          return layout;
+     }
+
+     template< typename T >
+     void Write( const T& value )
+     {
+          static_assert( std::is_trivially_copyable_v< T > );
+          payload_.append( reinterpret_cast< const char* >( &value ), sizeof( T ) );
+     }
+
+     // size followed by the elements
+     template< typename T >
+     void WriteArray( const std::vector< T >& values )
+     {
+          static_assert( std::is_trivially_copyable_v< T > );
+          Write< uint64_t >( values.size() );
+          payload_.append( reinterpret_cast< const char* >( values.data() ), values.size() * sizeof( T ) );
+     }
+
+     void WriteString( std::string_view value );
+
+     // header followed by everything written so far
+     std::string Finish() const;
+
+private:
+     uint64_t layout_;
+     std::string payload_;
+};
+
+// Reads back what SnapshotWriter wrote in the same order, throws
+// SnapshotError instead of reading past the end
+class SnapshotReader
+{
+public:
+     // checks the header, the layout and the checksum, throws SnapshotError
+     // on mismatch
+     SnapshotReader( std::string_view snapshot, uint64_t layout );
+
+     // whether data starts with the snapshot magic
+     static bool IsSnapshot( std::string_view data );
+
+     template< typename T >
+     T Read()
+     {
+          static_assert( std::is_trivially_copyable_v< T > );
+          std::array< char, sizeof( T ) > bytes;
+          std::memcpy( bytes.data(), Take( sizeof( T ) ), sizeof( T ) );
+          if constexpr( std::is_same_v< T, bool > )
+          {
+               Expect( static_cast< unsigned char >( bytes[ 0 ] ) <= 1, "flag" );
+          }
+          return std::bit_cast< T >( bytes );
+     }
+
+     template< typename T >
+     std::vector< T > ReadArray()
+     {
+          static_assert( std::is_trivially_copyable_v< T > );
+          const uint64_t size = Read< uint64_t >();
+          if( size > payload_.size() / sizeof( T ) )
+          {
+               throw SnapshotError( "snapshot is truncated" );
+          }
+          std::vector< T > values( size );
+          if( size != 0 )
+          {
+               std::memcpy( values.data(), Take( size * sizeof( T ) ), size * sizeof( T ) );
+          }
+          return values;
+     }
+
+     std::string_view ReadString();
+
+     bool AtEnd() const;
+
+     // throws SnapshotError naming what is inconsistent unless valid
+     void Expect( bool valid, std::string_view what ) const;
+
+private:
+     const char* Take( size_t size );
+
+     std::string_view payload_;
+};
+
+}
+
+#endif
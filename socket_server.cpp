@@ -0,0 +1,273 @@
+#include "socket_server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iterator>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace transport
+{
+
+namespace
+{
+
+bool WriteAll( int fd, std::string_view data )
+{
+     while( !data.empty() )
+     {
+          const ssize_t written = send( fd, data.data(), data.size(), MSG_NOSIGNAL );
+          if( written < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if( written <= 0 )
+          {
+               return false;
+          }
+          data.remove_prefix( static_cast< size_t >( written ) );
+     }
+     return true;
+}
+
+// Reads until the client hangs up. Answers of all complete lines in one
+// read are sent together, so pipelined requests cost one send per read.
+// The tail of an over-long line is skipped up to its newline
+void ServeConnection( int fd, const SocketServer::Session& session, std::string_view overlongAnswer )
+{
+     constexpr size_t ChunkSize = 64 * 1024;
+     std::string pending;
+     std::string answers;
+     bool discarding = false;
+     char chunk[ ChunkSize ];
+     for( ;; )
+     {
+          const ssize_t received = recv( fd, chunk, sizeof( chunk ), 0 );
+          if( received < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if( received <= 0 )
+          {
+               break;
+          }
+          std::string_view data( chunk, static_cast< size_t >( received ) );
+          if( discarding )
+          {
+               const size_t lineEnd = data.find( '\n' );
+               if( lineEnd == std::string_view::npos )
+               {
+                    continue;
+               }
+               data.remove_prefix( lineEnd + 1 );
+               discarding = false;
+          }
+          pending.append( data );
+
+          size_t lineBegin = 0;
+          for( size_t lineEnd; ( lineEnd = pending.find( '\n', lineBegin ) ) != std::string::npos; lineBegin = lineEnd + 1 )
+          {
+               const std::string_view answer = lineEnd - lineBegin > SocketServer::MaxLineSize
+                                               ? overlongAnswer
+                                               : session( std::string_view( pending ).substr( lineBegin, lineEnd - lineBegin ) );
+               if( !answer.empty() )
+               {
+                    answers += answer;
+                    answers += '\n';
+               }
+          }
+          pending.erase( 0, lineBegin );
+          if( pending.size() > SocketServer::MaxLineSize )
+          {
+               answers += overlongAnswer;
+               answers += '\n';
+               pending.clear();
+               discarding = true;
+          }
+          if( !WriteAll( fd, answers ) )
+          {
+               break;
+          }
+          answers.clear();
+     }
+}
+
+// Takes SIGINT and SIGTERM through a descriptor instead of a handler while
+// alive. Threads started meanwhile inherit the blocked mask
+class SignalBlock
+{
+public:
+     SignalBlock()
+     {
+          sigemptyset( &signals_ );
+          sigaddset( &signals_, SIGINT );
+          sigaddset( &signals_, SIGTERM );
+          pthread_sigmask( SIG_BLOCK, &signals_, &previous_ );
+          fd_ = signalfd( -1, &signals_, SFD_CLOEXEC );
+          if( fd_ < 0 )
+          {
+               const int error = errno;
+               pthread_sigmask( SIG_SETMASK, &previous_, nullptr );
+               throw std::system_error( error, std::generic_category(), "signalfd" );
+          }
+     }
+
+     ~SignalBlock()
+     {
+          close( fd_ );
+          pthread_sigmask( SIG_SETMASK, &previous_, nullptr );
+     }
+
+     SignalBlock( const SignalBlock& ) = delete;
+
+     SignalBlock& operator=( const SignalBlock& ) = delete;
+
+     int Fd() const
+     { return fd_; }
+
+     // consumes the pending signal, so it is not delivered once unblocked
+     void Take()
+     {
+          signalfd_siginfo info;
+          while( read( fd_, &info, sizeof( info ) ) < 0 && errno == EINTR )
+          {}
+     }
+
+private:
+     sigset_t signals_;
+     sigset_t previous_;
+     int fd_ = -1;
+};
+
+}
+
+SocketServer::SocketServer( const std::string& path, std::string overlongAnswer )
+          : path_( path )
+          , overlongAnswer_( std::move( overlongAnswer ) )
+{
+     sockaddr_un address {};
+     address.sun_family = AF_UNIX;
+     if( path.size() >= sizeof( address.sun_path ) )
+     {
+          throw std::system_error( ENAMETOOLONG, std::generic_category(), "socket " + path );
+     }
+     std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+     if( pipe2( stopFds_, O_CLOEXEC ) != 0 )
+     {
+          throw std::system_error( errno, std::generic_category(), "pipe" );
+     }
+     fd_ = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+     if( fd_ < 0 )
+     {
+          const int error = errno;
+          close( stopFds_[ 0 ] );
+          close( stopFds_[ 1 ] );
+          throw std::system_error( error, std::generic_category(), "socket " + path );
+     }
+     unlink( path.c_str() );
+     if( bind( fd_, reinterpret_cast< const sockaddr* >( &address ), sizeof( address ) ) != 0
+         || listen( fd_, SOMAXCONN ) != 0 )
+     {
+          const int error = errno;
+          close( fd_ );
+          close( stopFds_[ 0 ] );
+          close( stopFds_[ 1 ] );
+          throw std::system_error( error, std::generic_category(), "bind " + path );
+     }
+}
+
+SocketServer::~SocketServer()
+{
+     CloseConnections();
+     close( fd_ );
+     close( stopFds_[ 0 ] );
+     close( stopFds_[ 1 ] );
+     unlink( path_.c_str() );
+}
+
+void SocketServer::Run( const SessionFactory& sessionFactory )
+{
+     SignalBlock signals;
+     pollfd watched[] = { { fd_, POLLIN, 0 }, { signals.Fd(), POLLIN, 0 }, { stopFds_[ 0 ], POLLIN, 0 } };
+     for( ;; )
+     {
+          if( poll( watched, std::size( watched ), -1 ) < 0 )
+          {
+               if( errno == EINTR )
+               {
+                    continue;
+               }
+               throw std::system_error( errno, std::generic_category(), "poll " + path_ );
+          }
+          if( watched[ 1 ].revents != 0 )
+          {
+               signals.Take();
+               break;
+          }
+          if( watched[ 2 ].revents != 0 )
+          {
+               char byte;
+               read( stopFds_[ 0 ], &byte, 1 );
+               break;
+          }
+
+          const int client = accept4( fd_, nullptr, nullptr, SOCK_CLOEXEC );
+          if( client < 0 )
+          {
+               if( errno == EINTR || errno == ECONNABORTED )
+               {
+                    continue;
+               }
+               throw std::system_error( errno, std::generic_category(), "accept " + path_ );
+          }
+          {
+               std::lock_guard lock( mutex_ );
+               clients_.insert( client );
+          }
+          // the session goes before the connection is released, so nothing
+          // it refers to is touched once CloseConnections returns
+          std::thread( [ this, client, session = sessionFactory() ]() mutable
+                       {
+                            ServeConnection( client, session, overlongAnswer_ );
+                            session = nullptr;
+                            std::lock_guard lock( mutex_ );
+                            clients_.erase( client );
+                            close( client );
+                            idle_.notify_all();
+                       } ).detach();
+     }
+     CloseConnections();
+}
+
+void SocketServer::Stop()
+{
+     const char byte = 0;
+     while( write( stopFds_[ 1 ], &byte, 1 ) < 0 && errno == EINTR )
+     {}
+}
+
+void SocketServer::CloseConnections()
+{
+     std::unique_lock lock( mutex_ );
+     for( const int client: clients_ )
+     {
+          shutdown( client, SHUT_RDWR );
+     }
+     idle_.wait( lock, [ this ]
+                 {
+                      return clients_.empty();
+                 } );
+}
+
+}
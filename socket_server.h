@@ -0,0 +1,67 @@
+#ifndef YANDEX_BROWN_COURSE_SOCKET_SERVER_H
+#define YANDEX_BROWN_COURSE_SOCKET_SERVER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace transport
+{
+
+// Line protocol over a Unix-domain stream socket: every line a client sends
+// is passed to its session, and the returned text is sent back followed by
+// a newline. An empty answer sends nothing. Each connection is served on its
+// own thread with its own session
+class SocketServer
+{
+public:
+     // answers one line, called on the connection's thread only; the answer
+     // has to stay valid until the next call
+     using Session = std::function< std::string_view( std::string_view line ) >;
+
+     using SessionFactory = std::function< Session() >;
+
+     // longest line passed to a session, so a client that never sends a
+     // newline can't grow the connection's buffer without bound
+     static constexpr size_t MaxLineSize = 1 << 20;
+
+     // throws std::system_error if the socket can't be created or bound.
+     // A stale socket file left at path is replaced. Lines longer than
+     // MaxLineSize are discarded and answered with overlongAnswer
+     SocketServer( const std::string& path, std::string overlongAnswer );
+
+     ~SocketServer();
+
+     SocketServer( const SocketServer& ) = delete;
+
+     SocketServer& operator=( const SocketServer& ) = delete;
+
+     // accepts connections until SIGINT, SIGTERM or Stop, then shuts down the
+     // open connections, waits for their threads and returns. Throws
+     // std::system_error if accepting fails
+     void Run( const SessionFactory& sessionFactory );
+
+     // makes Run return, callable from any thread
+     void Stop();
+
+private:
+     void CloseConnections();
+
+     std::string path_;
+     std::string overlongAnswer_;
+     int fd_ = -1;
+     // Stop writes to the second end, Run polls the first
+     int stopFds_[ 2 ] = { -1, -1 };
+
+     std::mutex mutex_;
+     std::condition_variable idle_;
+     std::unordered_set< int > clients_;
+};
+
+}
+
+#endif
@@ -0,0 +1,37 @@
+#include "string_interner.h"
+
+namespace transport
+{
+
+StringInterner::Id StringInterner::Intern( std::string_view name )
+{
+     if( auto it = ids_.find( name ); it != ids_.end() )
+     {
+          return it->second;
+     }
+     const Id id = static_cast< Id >( names_.size() );
+     names_.emplace_back( name );
+     ids_.emplace( names_.back(), id );
+     return id;
+}
+
+std::optional< StringInterner::Id > StringInterner::Find( std::string_view name ) const
+{
+     if( auto it = ids_.find( name ); it != ids_.end() )
+     {
+          return it->second;
+     }
+     return std::nullopt;
+}
+
+std::string_view StringInterner::GetName( Id id ) const
+{
+     return names_[ id ];
+}
+
+size_t StringInterner::Size() const
+{
+     return names_.size();
+}
+
+}
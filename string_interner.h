@@ -0,0 +1,36 @@
+#ifndef YANDEX_BROWN_COURSE_STRING_INTERNER_H
+#define YANDEX_BROWN_COURSE_STRING_INTERNER_H
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace transport
+{
+
+// Maps names to dense ids in order of first appearance.
+// Names are kept in a deque, so returned views stay valid.
+class StringInterner
+{
+public:
+     using Id = uint32_t;
+
+     Id Intern( std::string_view name );
+
+     std::optional< Id > Find( std::string_view name ) const;
+
+     std::string_view GetName( Id id ) const;
+
+     size_t Size() const;
+
+private:
+     std::deque< std::string > names_;
+     std::unordered_map< std::string_view, Id > ids_;
+};
+
+}
+
+#endif
@@ -1,56 +1,128 @@
 #include "transport.h"
 #include "router.h"
+#include "contraction_hierarchy.h"
+#include "snapshot.h"
 
+#include <algorithm>
+#include <cassert>
 #include <utility>
 
 namespace transport
 {
 
+Transport::StopId Transport::InternStop( std::string_view name )
+{
+     const StopId id = stopNames_.Intern( name );
+     if( id >= stops_.size() )
+     {
+          stops_.resize( id + 1 );
+     }
+     return id;
+}
+
 void Transport::AddStop( const std::string& stopName, Stop stop, const std::vector< std::pair< std::string, unsigned int >>& roadLength )
 {
-     routeContext_.Reset();
-     StopInfo& stopInfo = stops_[ stopName ];
-     stopInfo.stop = stop;
+     const StopId stopId = InternStop( stopName );
+     // Only stops served by a bus have vertices. Road lengths of any other
+     // stop can't be used by an edge of the graph yet, so it stays valid.
+     if( routeContext_.HaveVertices( stopId ) )
+     {
+          routeContext_.Reset();
+     }
+     stops_[ stopId ].stop = stop;
      for( const auto& [ otherStopName, length ]: roadLength )
      {
-          stopInfo.roadLength[ otherStopName ] = length;
-          StopInfo& otherStop = stops_[ otherStopName ];
-          if( otherStop.roadLength.count( stopName ) == 0 )
-          {
-               stops_[ otherStopName ].roadLength[ stopName ] = length;
-          }
+          const StopId otherStopId = InternStop( otherStopName );
+          roadDistances_.Set( stopId, otherStopId, length );
+          roadDistances_.SetIfAbsent( otherStopId, stopId, length );
      }
 }
 
 void Transport::AddBus( std::string name, Bus bus )
 {
-     routeContext_.Reset();
+     const BusId busId = busNames_.Intern( name );
+     if( busId < buses_.size() )
+     {
+          return;
+     }
+
+     BusInfo busInfo { bus.GetBusType(), {}, bus.GetUniqueStops(), std::nullopt };
+     busInfo.stops.reserve( bus.GetRawStops().size() );
+     for( const auto& stop: bus.GetRawStops() )
+     {
+          busInfo.stops.push_back( InternStop( stop ) );
+     }
      for( const auto& stop: bus.GetUniqueStopsList() )
      {
-          stops_[ stop ].buses.insert( name );
+          auto& stopBuses = stops_[ InternStop( stop ) ].buses;
+          auto it = std::lower_bound( stopBuses.begin(), stopBuses.end(), name, [ this ]( BusId id, const std::string& busName )
+          {
+               return busNames_.GetName( id ) < busName;
+          } );
+          stopBuses.insert( it, busId );
+     }
+     buses_.push_back( std::move( busInfo ) );
+     if( routeContext_.graph )
+     {
+          routeContext_.pendingBuses.push_back( busId );
      }
-     buses_.insert( { std::move( name ), std::move( bus ) } );
 }
 
 std::optional< Bus::Stats > Transport::GetBusStats( const std::string& name )
 {
-     auto it = buses_.find( name );
-     if( it == buses_.end() )
+     auto busId = busNames_.Find( name );
+     if( !busId.has_value() )
      {
           return std::nullopt;
      }
-     Bus& bus = it->second;
-     return Bus::Stats { bus.GetStopsOnRoute(), bus.GetUniqueStops(), bus.GetLength( GetBusLengthCalculator() ) };
+     BusInfo& bus = buses_[ *busId ];
+     ComputeBusLength( bus );
+     return MakeBusStats( bus );
+}
+
+void Transport::ComputeBusLength( BusInfo& bus ) const
+{
+     if( bus.lengthInfo.has_value() )
+     {
+          return;
+     }
+     const auto forward = roadDistances_.FindAlong( bus.stops );
+     const auto backward = bus.type == Bus::Linear
+                           ? roadDistances_.FindAlong( { bus.stops.rbegin(), bus.stops.rend() } )
+                           : std::vector< std::optional< unsigned int > >();
+     bus.lengthInfo = { 0, 0 };
+     for( size_t i = 0; i + 1 < bus.stops.size(); ++i )
+     {
+          bus.lengthInfo.value() += GetLength( bus.stops[ i ], bus.stops[ i + 1 ], forward[ i ] );
+          if( bus.type == Bus::Linear )
+          {
+               bus.lengthInfo.value() += GetLength( bus.stops[ i + 1 ], bus.stops[ i ],
+                                                    backward[ backward.size() - 1 - i ] );
+          }
+     }
+}
+
+Bus::Stats Transport::MakeBusStats( const BusInfo& bus ) const
+{
+     const size_t stopsOnRoute = bus.stops.empty()
+                                 ? 0
+                                 : bus.type == Bus::Linear ? bus.stops.size() * 2 - 1 : bus.stops.size();
+     return Bus::Stats { stopsOnRoute, bus.uniqueStops, bus.lengthInfo.value() };
 }
 
-const std::set< std::string >* Transport::GetStopBusList( const std::string& name ) const
+const std::vector< Transport::BusId >* Transport::GetStopBusList( const std::string& name ) const
 {
-     auto it = stops_.find( name );
-     if( it == stops_.end() )
+     auto stopId = stopNames_.Find( name );
+     if( !stopId.has_value() )
      {
           return nullptr;
      }
-     return &it->second.buses;
+     return &stops_[ *stopId ].buses;
+}
+
+std::string_view Transport::GetBusName( BusId id ) const
+{
+     return busNames_.GetName( id );
 }
 
 std::variant< Transport::RouteResult, std::string > Transport::GetRoute( const std::string& from, const std::string& to ) const
@@ -59,135 +131,481 @@ std::variant< Transport::RouteResult, std::string > Transport::GetRoute( const s
      {
           InitRouterContext();
      }
+     else if( !routeContext_.pendingBuses.empty() )
+     {
+          ApplyPendingBuses();
+     }
+     return FindRouteBetween( from, to, [ this ]( Graph::VertexId fromVertex, Graph::VertexId toVertex )
+     {
+          auto& edges = routeContext_.routeEdges;
+          const auto time = routeContext_.hierarchy
+                            ? routeContext_.hierarchy->FindRoute( fromVertex, toVertex, edges )
+                            : routeContext_.router->FindRoute( fromVertex, toVertex, edges );
+          return MakeRouteResult( time, edges );
+     } );
+}
+
+template< typename FindRoute >
+std::variant< Transport::RouteResult, std::string >
+Transport::FindRouteBetween( const std::string& from, const std::string& to, FindRoute findRoute ) const
+{
+     auto fromId = stopNames_.Find( from );
+     auto toId = stopNames_.Find( to );
+     if( !fromId || !toId || !routeContext_.HaveVertices( *fromId ) || !routeContext_.HaveVertices( *toId ) )
+     {
+          // a stop without buses is reachable only from itself
+          if( from == to )
+          {
+               return RouteResult { 0, {} };
+          }
+          return "not found";
+     }
+     return findRoute( routeContext_.stopVertices[ *fromId ].in, routeContext_.stopVertices[ *toId ].in );
+}
 
-     Graph::VertexId fromId = routeContext_.vertexNameToId.at( from ).first;
-     Graph::VertexId toId = routeContext_.vertexNameToId.at( to ).first;
-     auto result = routeContext_.router->BuildRoute( fromId, toId );
-     if( !result.has_value() )
+std::variant< Transport::RouteResult, std::string >
+Transport::MakeRouteResult( std::optional< Widget > time, const std::vector< Graph::EdgeId >& edges ) const
+{
+     if( !time.has_value() )
      {
           return "not found";
      }
-     const Graph::Router< Widget >::RouteInfo& routeInfo = result.value();
      RouteResult routeResult;
-     routeResult.time = routeInfo.weight;
-     routeResult.items.reserve( routeInfo.edge_count );
-     for( size_t edgeIndex = 0; edgeIndex < routeInfo.edge_count; ++edgeIndex )
-     {
-          Graph::EdgeId edgeId = routeContext_.router->GetRouteEdge( result.value().id, edgeIndex );
-          const EdgeWidget& edgeWidget = routeContext_.edges.at( edgeId );
-          RouteItemPtr item;
-          if( edgeWidget.waitEdge )
+     routeResult.time = time.value();
+     std::unique_ptr< BusItem > busItem;
+     for( const Graph::EdgeId edgeId : edges )
+     {
+          const EdgeWidget& edgeWidget = routeContext_.edges[ edgeId ];
+          switch( edgeWidget.type )
           {
-               const std::string& stopName = routeContext_.vertexIdToName.at( edgeWidget.from ).first;
-               item = std::make_unique< WaitItem >( stopName, edgeWidget.weight );
+               case EdgeWidget::Wait:
+                    routeResult.items.push_back(
+                              std::make_unique< WaitItem >( stopNames_.GetName( edgeWidget.owner ), edgeWidget.weight ) );
+                    break;
+               case EdgeWidget::Board:
+                    busItem = std::make_unique< BusItem >( busNames_.GetName( edgeWidget.owner ), 0, 0 );
+                    break;
+               case EdgeWidget::Ride:
+                    busItem->AddSpan( edgeWidget.weight );
+                    break;
+               case EdgeWidget::Alight:
+                    routeResult.items.push_back( std::move( busItem ) );
+                    break;
           }
-          else
+     }
+     return routeResult;
+}
+
+Bus::LengthInfo Transport::GetLength( StopId from, StopId to, std::optional< unsigned int > roadLength ) const
+{
+     Bus::LengthInfo lengthInfo{};
+     lengthInfo.length = CalculateLength( stops_[ from ].stop.value(), stops_[ to ].stop.value() );
+     lengthInfo.roadLength = roadLength.value_or( 0 );
+     return lengthInfo;
+}
+
+void Transport::SetSettings( Settings settings )
+{
+     routeContext_.Reset();
+     settings_ = settings;
+}
+
+const Transport::Settings& Transport::GetSettings() const
+{
+     return settings_;
+}
+
+void Transport::Freeze()
+{
+     if( !routeContext_.HaveRouter() )
+     {
+          InitRouterContext();
+     }
+     else if( !routeContext_.pendingBuses.empty() )
+     {
+          ApplyPendingBuses();
+     }
+     for( auto& bus : buses_ )
+     {
+          ComputeBusLength( bus );
+     }
+}
+
+constexpr uint64_t Transport::SnapshotLayout()
+{
+     return SnapshotWriter::Layout( { sizeof( Graph::VertexId ), sizeof( Graph::EdgeId ), sizeof( Widget ),
+                                      sizeof( EdgeWidget ), sizeof( StopVertices ), sizeof( Stop ),
+                                      sizeof( Bus::LengthInfo ), sizeof( StopId ), sizeof( BusId ),
+                                      sizeof( Settings::RoutingMode ), sizeof( Bus::Type ) } );
+}
+
+std::string Transport::SaveSnapshot()
+{
+     Freeze();
+     SnapshotWriter output( SnapshotLayout() );
+     // field by field, padding would make equal snapshots differ
+     output.Write( settings_.busWaitTime );
+     output.Write( settings_.busVelocity );
+     output.Write< uint64_t >( settings_.routerThreads );
+     output.Write( settings_.routingMode );
+     output.Write< uint64_t >( settings_.statThreads );
+
+     output.Write< uint64_t >( stops_.size() );
+     for( StopId stopId = 0; stopId < stops_.size(); ++stopId )
+     {
+          const StopInfo& stop = stops_[ stopId ];
+          output.WriteString( stopNames_.GetName( stopId ) );
+          output.Write( stop.stop.has_value() );
+          if( stop.stop.has_value() )
           {
-               item = std::make_unique< BusItem >( edgeWidget.busName, edgeWidget.spanCount, edgeWidget.weight );
+               output.Write( stop.stop.value() );
           }
-          routeResult.items.push_back( std::move( item ) );
+          output.WriteArray( stop.buses );
      }
-     return routeResult;
+
+     output.Write< uint64_t >( buses_.size() );
+     for( BusId busId = 0; busId < buses_.size(); ++busId )
+     {
+          const BusInfo& bus = buses_[ busId ];
+          output.WriteString( busNames_.GetName( busId ) );
+          output.Write( bus.type );
+          output.WriteArray( bus.stops );
+          output.Write< uint64_t >( bus.uniqueStops );
+          output.Write( bus.lengthInfo.value() );
+     }
+     roadDistances_.Save( output );
+
+     // the graph is rebuilt from the edges, it has the same edge ids
+     output.Write< uint64_t >( routeContext_.graph->GetVertexCount() );
+     output.WriteArray( routeContext_.stopVertices );
+     output.WriteArray( routeContext_.edges );
+     output.Write( !!routeContext_.hierarchy );
+     if( routeContext_.hierarchy )
+     {
+          routeContext_.hierarchy->Save( output );
+     }
+     else
+     {
+          routeContext_.router->Save( output );
+     }
+     return output.Finish();
 }
 
-Bus::LengthCalculator Transport::GetBusLengthCalculator()
+Transport Transport::LoadSnapshot( std::string_view snapshot )
 {
-     return [ = ]( const std::string& s1, const std::string& s2 )->Bus::LengthInfo
+     SnapshotReader input( snapshot, SnapshotLayout() );
+     Transport transport;
+     Settings& settings = transport.settings_;
+     settings.busWaitTime = input.Read< double >();
+     settings.busVelocity = input.Read< double >();
+     settings.routerThreads = input.Read< uint64_t >();
+     settings.routingMode = input.Read< Settings::RoutingMode >();
+     input.Expect( settings.routingMode <= Settings::ContractionHierarchies, "routing mode" );
+     settings.statThreads = input.Read< uint64_t >();
+
+     // sizes are checked against the payload before anything is allocated
+     const uint64_t stopCount = input.Read< uint64_t >();
+     input.Expect( stopCount <= snapshot.size(), "stop count" );
+     transport.stops_.resize( stopCount );
+     for( StopInfo& stop: transport.stops_ )
      {
-          Bus::LengthInfo lengthInfo{};
-          lengthInfo.length = CalculateLength( stops_.at( s1 ).stop.value(), stops_.at( s2 ).stop.value() );
-          lengthInfo.roadLength = stops_.at( s1 ).roadLength[ s2 ];
-          return lengthInfo;
+          transport.stopNames_.Intern( input.ReadString() );
+          if( input.Read< bool >() )
+          {
+               stop.stop = input.Read< Stop >();
+          }
+          stop.buses = input.ReadArray< BusId >();
+     }
+     input.Expect( transport.stopNames_.Size() == stopCount, "stop names" );
+
+     const uint64_t busCount = input.Read< uint64_t >();
+     input.Expect( busCount <= snapshot.size(), "bus count" );
+     transport.buses_.resize( busCount );
+     // every vertex is a stop's in or out vertex or a ride vertex of a bus stop
+     uint64_t vertexLimit = 2 * stopCount;
+     for( BusInfo& bus: transport.buses_ )
+     {
+          transport.busNames_.Intern( input.ReadString() );
+          bus.type = input.Read< Bus::Type >();
+          input.Expect( bus.type <= Bus::Circular, "bus type" );
+          bus.stops = input.ReadArray< StopId >();
+          input.Expect( std::all_of( bus.stops.begin(), bus.stops.end(), [ stopCount ]( StopId stop )
+                        {
+                             return stop < stopCount;
+                        } ), "bus stops" );
+          vertexLimit += 2 * bus.stops.size();
+          bus.uniqueStops = input.Read< uint64_t >();
+          bus.lengthInfo = input.Read< Bus::LengthInfo >();
+     }
+     input.Expect( transport.busNames_.Size() == busCount, "bus names" );
+     for( const StopInfo& stop: transport.stops_ )
+     {
+          input.Expect( std::all_of( stop.buses.begin(), stop.buses.end(), [ busCount ]( BusId bus )
+                        {
+                             return bus < busCount;
+                        } ), "stop buses" );
+     }
+     transport.roadDistances_ = RoadDistances::Load( input );
+
+     RouteContext& routeContext = transport.routeContext_;
+     const uint64_t vertexCount = input.Read< uint64_t >();
+     input.Expect( vertexCount <= vertexLimit, "vertex count" );
+     routeContext.graph = std::make_unique< Graph::DirectedWeightedGraph< Widget > >( vertexCount );
+     routeContext.stopVertices = input.ReadArray< StopVertices >();
+     input.Expect( routeContext.stopVertices.size() <= stopCount, "stop vertices" );
+
+     // stop vertices are distinct, every other vertex is a ride vertex
+     enum VertexKind : uint8_t
+     {
+          RideVertex,
+          InVertex,
+          OutVertex
      };
+     std::vector< VertexKind > kinds( vertexCount, RideVertex );
+     for( const StopVertices& vertices: routeContext.stopVertices )
+     {
+          if( vertices.in == StopVertices::NONE && vertices.out == StopVertices::NONE )
+          {
+               continue;
+          }
+          input.Expect( vertices.in < vertexCount && vertices.out < vertexCount
+                        && vertices.in != vertices.out
+                        && kinds[ vertices.in ] == RideVertex && kinds[ vertices.out ] == RideVertex,
+                        "stop vertices" );
+          kinds[ vertices.in ] = InVertex;
+          kinds[ vertices.out ] = OutVertex;
+     }
+
+     // edge types follow the vertex kinds, so a route always boards before it rides
+     routeContext.edges = input.ReadArray< EdgeWidget >();
+     for( const EdgeWidget& edge: routeContext.edges )
+     {
+          bool valid = edge.from < vertexCount && edge.to < vertexCount && edge.weight >= 0;
+          if( valid )
+          {
+               switch( edge.type )
+               {
+                    case EdgeWidget::Wait:
+                         valid = routeContext.HaveVertices( edge.owner )
+                                 && routeContext.stopVertices[ edge.owner ].in == edge.from
+                                 && routeContext.stopVertices[ edge.owner ].out == edge.to;
+                         break;
+                    case EdgeWidget::Board:
+                         valid = edge.owner < busCount && kinds[ edge.from ] == OutVertex && kinds[ edge.to ] == RideVertex;
+                         break;
+                    case EdgeWidget::Ride:
+                         valid = edge.owner < busCount && kinds[ edge.from ] == RideVertex && kinds[ edge.to ] == RideVertex;
+                         break;
+                    case EdgeWidget::Alight:
+                         valid = edge.owner < busCount && kinds[ edge.from ] == RideVertex && kinds[ edge.to ] == InVertex;
+                         break;
+                    default:
+                         valid = false;
+               }
+          }
+          input.Expect( valid, "route graph edges" );
+          routeContext.graph->AddEdge( { edge.from, edge.to, edge.weight } );
+     }
+     routeContext.graph->Freeze();
+     if( input.Read< bool >() )
+     {
+          routeContext.hierarchy = Graph::ContractionHierarchy< Widget >::Load( *routeContext.graph, input );
+     }
+     else
+     {
+          routeContext.router = Graph::Router< Widget >::Load( *routeContext.graph, input );
+     }
+     if( !input.AtEnd() )
+     {
+          throw SnapshotError( "snapshot has trailing data" );
+     }
+     return transport;
 }
 
-void Transport::SetSettings( Settings settings )
+Transport::Reader::Reader( const Transport& transport )
+          : transport_( transport )
 {
-     settings_ = settings;
+     const auto& routeContext = transport.routeContext_;
+     assert( routeContext.HaveRouter() && routeContext.pendingBuses.empty() );
+     if( routeContext.hierarchy )
+     {
+          hierarchy_.emplace( *routeContext.hierarchy );
+     }
+     else
+     {
+          router_.emplace( *routeContext.router );
+     }
+}
+
+std::optional< Bus::Stats > Transport::Reader::GetBusStats( const std::string& name ) const
+{
+     auto busId = transport_.busNames_.Find( name );
+     if( !busId.has_value() )
+     {
+          return std::nullopt;
+     }
+     return transport_.MakeBusStats( transport_.buses_[ *busId ] );
+}
+
+const std::vector< Transport::BusId >* Transport::Reader::GetStopBusList( const std::string& name ) const
+{
+     return transport_.GetStopBusList( name );
+}
+
+std::string_view Transport::Reader::GetBusName( BusId id ) const
+{
+     return transport_.GetBusName( id );
+}
+
+std::variant< Transport::RouteResult, std::string >
+Transport::Reader::GetRoute( const std::string& from, const std::string& to )
+{
+     return transport_.FindRouteBetween( from, to, [ this ]( Graph::VertexId fromVertex, Graph::VertexId toVertex )
+     {
+          const auto time = hierarchy_
+                            ? hierarchy_->FindRoute( fromVertex, toVertex, routeEdges_ )
+                            : router_->FindRoute( fromVertex, toVertex, routeEdges_ );
+          return transport_.MakeRouteResult( time, routeEdges_ );
+     } );
 }
 
 void Transport::InitRouterContext() const
 {
-     routeContext_.graph = std::make_unique< Graph::DirectedWeightedGraph< Widget > >( stops_.size() * 2 );
-     AddStopsToRouteContext();
-     AddBusesToRouteContext();
-     routeContext_.router = std::make_unique< Graph::Router< Widget > >( *routeContext_.graph );
+     routeContext_.Reset();
+     routeContext_.graph = std::make_unique< Graph::DirectedWeightedGraph< Widget > >( 0 );
+     for( BusId busId = 0; busId < buses_.size(); ++busId )
+     {
+          AddBusToRouteContext( busId );
+     }
+     routeContext_.graph->Freeze();
+     if( settings_.routingMode == Settings::ContractionHierarchies )
+     {
+          routeContext_.hierarchy = std::make_unique< Graph::ContractionHierarchy< Widget > >( *routeContext_.graph );
+          return;
+     }
+     if( settings_.routerThreads == 0 )
+     {
+          routeContext_.router = std::make_unique< Graph::Router< Widget > >( *routeContext_.graph );
+          return;
+     }
+
+     std::vector< Graph::VertexId > sources;
+     for( StopId stopId = 0; stopId < routeContext_.stopVertices.size(); ++stopId )
+     {
+          if( routeContext_.HaveVertices( stopId ) )
+          {
+               sources.push_back( routeContext_.stopVertices[ stopId ].in );
+          }
+     }
+     routeContext_.router = std::make_unique< Graph::Router< Widget > >( *routeContext_.graph, sources.size() );
+     routeContext_.router->Precompute( sources, settings_.routerThreads );
 }
 
-void Transport::AddStopsToRouteContext() const
+void Transport::ApplyPendingBuses() const
 {
-     Graph::VertexId id = 0;
-     for( const auto& [ stop, stopInfo ]: stops_ )
+     if( routeContext_.hierarchy )
      {
-          Graph::VertexId inId = id++;
-          Graph::VertexId outId = id++;
-          routeContext_.vertexIdToName[ inId ] = { stop, In };
-          routeContext_.vertexIdToName[ outId ] = { stop, Out };
-          routeContext_.vertexNameToId[ stop ] = { inId, outId };
-          Graph::EdgeId edgeId = routeContext_.graph->AddEdge( { inId, outId, settings_.busWaitTime });
-          routeContext_.edges.insert({ edgeId, EdgeWidget( settings_.busWaitTime, inId, outId ) } );
+          // the hierarchy can't be updated in place
+          InitRouterContext();
+          return;
      }
+
+     // New edges only leave out vertices of the stops the buses serve, so
+     // only trees reaching one of those stops may get shorter paths
+     std::vector< Graph::VertexId > boardingVertices;
+     for( const BusId busId: routeContext_.pendingBuses )
+     {
+          AddBusToRouteContext( busId );
+          for( const StopId stop: buses_[ busId ].stops )
+          {
+               if( routeContext_.HaveVertices( stop ) )
+               {
+                    boardingVertices.push_back( routeContext_.stopVertices[ stop ].out );
+               }
+          }
+     }
+     routeContext_.pendingBuses.clear();
+     routeContext_.graph->Freeze();
+     routeContext_.router->InvalidateTreesReaching( boardingVertices );
+}
+
+Transport::StopVertices Transport::AddStopToRouteContext( StopId stop ) const
+{
+     if( routeContext_.HaveVertices( stop ) )
+     {
+          return routeContext_.stopVertices[ stop ];
+     }
+     if( stop >= routeContext_.stopVertices.size() )
+     {
+          routeContext_.stopVertices.resize( stop + 1 );
+     }
+     StopVertices& vertices = routeContext_.stopVertices[ stop ];
+     vertices.in = routeContext_.graph->AddVertex();
+     vertices.out = routeContext_.graph->AddVertex();
+     AddRouteContextEdge( EdgeWidget( EdgeWidget::Wait, settings_.busWaitTime, vertices.in, vertices.out, stop ) );
+     return vertices;
+}
+
+void Transport::AddRouteContextEdge( const EdgeWidget& edge ) const
+{
+     routeContext_.graph->AddEdge( { edge.from, edge.to, edge.weight } );
+     routeContext_.edges.push_back( edge );
 }
 
-static std::vector< std::string > ConvertBusStops( const Bus& bus )
+static std::vector< Transport::StopId > ConvertBusStops( Bus::Type type, const std::vector< Transport::StopId >& rawStops )
 {
-     switch( bus.GetBusType() )
+     switch( type )
      {
           case Bus::Linear:
           {
-               std::vector< std::string > stops = bus.GetRawStops();
+               std::vector< Transport::StopId > stops = rawStops;
                // a - b - c (3)
                // a - b - c - b - a (5)
                //       
                stops.resize( stops.size() * 2 - 1 );
                auto it = stops.begin();
-               std::advance( it, bus.GetRawStops().size() );
-               std::copy( std::next( bus.GetRawStops().rbegin() ), bus.GetRawStops().rend(), it );
+               std::advance( it, rawStops.size() );
+               std::copy( std::next( rawStops.rbegin() ), rawStops.rend(), it );
                return stops;
           }
           case Bus::Circular:
-               return bus.GetRawStops();
+               return rawStops;
           default:
                throw std::runtime_error("");
      }
 }
 
-void Transport::AddBusesToRouteContext() const
+void Transport::AddBusToRouteContext( BusId busId ) const
 {
-     for( const auto& [ busName, bus ]: buses_ )
+     const BusInfo& bus = buses_[ busId ];
+     const std::vector< StopId > busStops = ConvertBusStops( bus.type, bus.stops );
+     if( busStops.empty() || busStops.size() == 1 )
      {
-          const std::vector< std::string > busStops = ConvertBusStops( bus );
-          if( busStops.empty() || busStops.size() == 1 )
+          return;
+     }
+     // A - B - C - B - A
+     // ^   ^   ^   ^   ^   Board from out(A), out(B), ...
+     // A > B > C > B > A   Ride between neighbouring stops
+     //     v   v   v   v   Alight to in(B), in(C), ...
+
+     const auto roadLengths = roadDistances_.FindAlong( busStops );
+     Graph::VertexId prevRideId = 0;
+     for( size_t idx = 0; idx < busStops.size(); ++idx )
+     {
+          const StopVertices stopVertices = AddStopToRouteContext( busStops[ idx ] );
+          const Graph::VertexId rideId = routeContext_.graph->AddVertex();
+          if( idx > 0 )
           {
-               continue;
+               double roadLength = roadLengths[ idx - 1 ].value();
+               AddRouteContextEdge( EdgeWidget( EdgeWidget::Ride, roadLength / settings_.busVelocity,
+                                                prevRideId, rideId, busId ) );
+               AddRouteContextEdge( EdgeWidget( EdgeWidget::Alight, 0, rideId, stopVertices.in, busId ) );
           }
-          // A - B - C - B - A
-          // A > B
-          // A >   > C
-          // A >   >   > B
-          // A >   >   >   > A
-
-          for( size_t in = 0; in < ( busStops.size() - 1 ); ++in )
+          if( idx + 1 < busStops.size() )
           {
-               double forwardTime = 0;
-
-               for( size_t out = ( in + 1 ); out < busStops.size(); ++out )
-               {
-                    const std::string& fromStop = busStops[ in ];
-                    const std::string& toStop = busStops[ out ];
-                    Graph::VertexId fromOutId = routeContext_.vertexNameToId[ fromStop ].second;
-                    Graph::VertexId toInId = routeContext_.vertexNameToId[ toStop ].first;
-
-                    const std::string& prevStop = busStops[ ( out - 1 ) ];
-
-                    const StopInfo& prevStopInfo = stops_.at( prevStop );
-                    double roadLength = prevStopInfo.roadLength.at( toStop );
-                    forwardTime += roadLength / settings_.busVelocity;
-
-                    Graph::EdgeId edgeId = routeContext_.graph->AddEdge( { fromOutId, toInId,  forwardTime });
-                    routeContext_.edges.insert( { edgeId, EdgeWidget( forwardTime, fromOutId, toInId, busName, ( out - in ) ) } );
-               }
+               AddRouteContextEdge( EdgeWidget( EdgeWidget::Board, 0, stopVertices.out, rideId, busId ) );
           }
+          prevRideId = rideId;
      }
 }
 
@@ -5,7 +5,12 @@
 #include "bus.h"
 #include "graph.h"
 #include "router.h"
+#include "contraction_hierarchy.h"
 #include "route_item.h"
+#include "string_interner.h"
+#include "road_distances.h"
+
+#include <limits>
 #include <variant>
 
 namespace transport
@@ -13,74 +18,119 @@ namespace transport
 
 class Transport
 {
+public:
+     using StopId = StringInterner::Id;
+     using BusId = StringInterner::Id;
+
+private:
      struct StopInfo
      {
           std::optional< Stop > stop;
-          std::set< std::string > buses;
-          std::unordered_map< std::string, unsigned int > roadLength;
+          // sorted by bus name
+          std::vector< BusId > buses;
+     };
+
+     struct BusInfo
+     {
+          Bus::Type type;
+          std::vector< StopId > stops;
+          size_t uniqueStops;
+          std::optional< Bus::LengthInfo > lengthInfo;
      };
 
      typedef double Widget;
 
+     // A bus ride is modelled with one ride vertex per stop of the route:
+     // out(stop) -Board-> ride(i) -Ride-> ride(i + 1) ... ride(j) -Alight-> in(stop),
+     // so every bus adds O(k) edges instead of an edge for every pair of stops
      struct EdgeWidget
      {
+          enum Type
+          {
+               Wait,
+               Board,
+               Ride,
+               Alight
+          };
+
           double weight;
-          bool waitEdge;
-          std::string busName;
-          size_t spanCount;
+          Type type;
+          // stop waited at for Wait edges, otherwise the bus
+          StringInterner::Id owner;
           Graph::VertexId from;
           Graph::VertexId to;
 
-          EdgeWidget( double w, Graph::VertexId fromId, Graph::VertexId toId )
-                    : weight( w )
-                    , waitEdge( true )
-                    , busName()
-                    , spanCount( 0 )
-                    , from( fromId )
-                    , to( toId )
-          {}
+          EdgeWidget() = default;
 
-          EdgeWidget( double w, Graph::VertexId fromId, Graph::VertexId toId, std::string bus, size_t span )
+          EdgeWidget( Type t, double w, Graph::VertexId fromId, Graph::VertexId toId, StringInterner::Id ownerId )
                     : weight( w )
-                    , waitEdge( false )
-                    , busName( std::move( bus ) )
-                    , spanCount( span )
+                    , type( t )
+                    , owner( ownerId )
                     , from( fromId )
                     , to( toId )
           {}
      };
 
-     enum StopType
+     struct StopVertices
      {
-          In,
-          Out
+          static constexpr Graph::VertexId NONE = std::numeric_limits< Graph::VertexId >::max();
+
+          Graph::VertexId in = NONE;
+          Graph::VertexId out = NONE;
      };
 
      struct RouteContext
      {
           std::unique_ptr< Graph::Router< Widget > > router;
+          std::unique_ptr< Graph::ContractionHierarchy< Widget > > hierarchy;
           std::unique_ptr< Graph::DirectedWeightedGraph< Widget > > graph;
-          std::unordered_map< Graph::VertexId, std::pair< std::string, StopType > > vertexIdToName;
-          std::unordered_map< std::string, std::pair< Graph::VertexId, Graph::VertexId > > vertexNameToId;
-          std::unordered_map< Graph::EdgeId, EdgeWidget > edges;
+          // indexed by StopId, only stops served by a bus have vertices
+          std::vector< StopVertices > stopVertices;
+          std::vector< EdgeWidget > edges;
+          // Buses added after the graph was built, applied on the next GetRoute
+          std::vector< BusId > pendingBuses;
+          // edges of the last route found, kept to reuse the storage
+          std::vector< Graph::EdgeId > routeEdges;
 
           bool HaveRouter() const
           {
-               return !!router && !!graph;
+               return ( !!router || !!hierarchy ) && !!graph;
+          }
+
+          bool HaveVertices( StopId stop ) const
+          {
+               return stop < stopVertices.size() && stopVertices[ stop ].in != StopVertices::NONE;
           }
 
           void Reset()
           {
+               stopVertices.clear();
+               edges.clear();
+               pendingBuses.clear();
                graph.reset();
                router.reset();
+               hierarchy.reset();
           }
      };
 
 public:
      struct Settings
      {
+          enum RoutingMode
+          {
+               Dijkstra,
+               ContractionHierarchies
+          };
+
           double busWaitTime;
           double busVelocity;
+          // 0 builds routes lazily, otherwise trees of all stops are built
+          // on that many threads when the router is initialized
+          size_t routerThreads = 0;
+          RoutingMode routingMode = Dijkstra;
+          // 0 answers stat requests one by one, otherwise runs of them are
+          // spread over that many threads
+          size_t statThreads = 0;
      };
 
      struct RouteResult
@@ -89,6 +139,8 @@ public:
           std::vector< RouteItemPtr > items;
      };
 
+     class Reader;
+
      void AddStop( const std::string& stopName, Stop stop,
                    const std::vector< std::pair< std::string, unsigned int >>& roadLength );
 
@@ -96,28 +148,95 @@ public:
 
      std::optional< Bus::Stats > GetBusStats( const std::string& name );
 
-     const std::set< std::string >* GetStopBusList( const std::string& name ) const;
+     // Bus ids sorted by name, nullptr for an unknown stop
+     const std::vector< BusId >* GetStopBusList( const std::string& name ) const;
+
+     std::string_view GetBusName( BusId id ) const;
 
      std::variant< RouteResult, std::string > GetRoute( const std::string& from, const std::string& to ) const;
 
      void SetSettings( Settings settings );
 
+     const Settings& GetSettings() const;
+
+     // Builds everything queries would otherwise build lazily: the route
+     // graph and router, and the lengths of all buses. Until the next Add*
+     // or SetSettings, Readers may then query it concurrently
+     void Freeze();
+
+     // Binary image of the network, the route graph and the built router,
+     // see snapshot.h for the format. Freezes the Transport first
+     std::string SaveSnapshot();
+
+     // Restores a frozen Transport from SaveSnapshot output without building
+     // the router again, throws SnapshotError for an invalid snapshot
+     static Transport LoadSnapshot( std::string_view snapshot );
+
 private:
-     Bus::LengthCalculator GetBusLengthCalculator();
+     StopId InternStop( std::string_view name );
+
+     // computes and keeps the length of the bus on first use
+     void ComputeBusLength( BusInfo& bus ) const;
+
+     Bus::Stats MakeBusStats( const BusInfo& bus ) const;
+
+     Bus::LengthInfo GetLength( StopId from, StopId to, std::optional< unsigned int > roadLength ) const;
 
      void InitRouterContext() const;
 
-     void AddStopsToRouteContext() const;
+     // Looks up the vertices of both stops and passes them to findRoute
+     template< typename FindRoute >
+     std::variant< RouteResult, std::string >
+     FindRouteBetween( const std::string& from, const std::string& to, FindRoute findRoute ) const;
+
+     std::variant< RouteResult, std::string >
+     MakeRouteResult( std::optional< Widget > time, const std::vector< Graph::EdgeId >& edges ) const;
+
+     void ApplyPendingBuses() const;
+
+     StopVertices AddStopToRouteContext( StopId stop ) const;
+
+     void AddBusToRouteContext( BusId busId ) const;
+
+     void AddRouteContextEdge( const EdgeWidget& edge ) const;
 
-     void AddBusesToRouteContext() const;
+     // fingerprint of the types a snapshot stores raw
+     static constexpr uint64_t SnapshotLayout();
 
 private:
-     std::unordered_map< std::string, StopInfo > stops_;
-     std::unordered_map< std::string, Bus > buses_;
+     StringInterner stopNames_;
+     StringInterner busNames_;
+     // indexed by StopId and BusId
+     std::vector< StopInfo > stops_;
+     std::vector< BusInfo > buses_;
+     RoadDistances roadDistances_;
      Settings settings_;
      mutable RouteContext routeContext_;
 };
 
+// Queries of one thread against a frozen Transport. Readers keep their own
+// search state and share the Transport read-only, so any number of them can
+// run at once. The Transport must not change while they are in use
+class Transport::Reader
+{
+public:
+     explicit Reader( const Transport& transport );
+
+     std::optional< Bus::Stats > GetBusStats( const std::string& name ) const;
+
+     const std::vector< BusId >* GetStopBusList( const std::string& name ) const;
+
+     std::string_view GetBusName( BusId id ) const;
+
+     std::variant< RouteResult, std::string > GetRoute( const std::string& from, const std::string& to );
+
+private:
+     const Transport& transport_;
+     std::optional< Graph::Router< Widget >::Reader > router_;
+     std::optional< Graph::ContractionHierarchy< Widget >::Reader > hierarchy_;
+     std::vector< Graph::EdgeId > routeEdges_;
+};
+
 }
 
 #endif
@@ -4,6 +4,23 @@
 #include <cassert>
 #include <iomanip>
 #include <fstream>
+#include <iterator>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "test_runner.h"
 #include "json.h"
@@ -11,9 +28,23 @@
 #include "bus.h"
 #include "transport.h"
 #include "request.h"
+#include "mapped_file.h"
+#include "socket_server.h"
+#include "snapshot.h"
 
 using namespace transport;
 
+// Road distances are kept as unsigned int, lengths outside it are rejected
+// rather than wrapped
+unsigned int CheckedRoadDistance( int64_t value )
+{
+     if( value < 0 || value > std::numeric_limits< unsigned int >::max() )
+     {
+          throw std::out_of_range( "road distance out of range: " + std::to_string( value ) );
+     }
+     return static_cast< unsigned int >( value );
+}
+
 struct AddStop
           : public AddRequest
 {
@@ -28,11 +59,18 @@ struct AddStop
           roadLength.reserve( roadDistance.size() );
           for( const auto& [ key, valueNode ]: roadDistance )
           {
-               roadLength.emplace_back( key, valueNode.AsInt() );
+               roadLength.emplace_back( key, CheckedRoadDistance( valueNode.AsInt64() ) );
           }
 
      }
 
+     void ParsingFrom( RequestFields&& fields ) override
+     {
+          stopName = std::move( fields.name );
+          stop = Stop( fields.latitude, fields.longitude );
+          roadLength = std::move( fields.roadDistances );
+     }
+
      void Process( Transport& transport ) const override
      {
           transport.AddStop( stopName, stop.value(), roadLength );
@@ -60,7 +98,17 @@ struct AddBus
           bus = Bus( requestMap.at( "is_roundtrip" ).AsBool()? Bus::Type::Circular: Bus::Type::Linear );
           for( const auto& item: requestMap.at( "stops" ).AsArray() )
           {
-               bus->AddStop( item.AsString() );
+               bus->AddStop( std::string( item.AsString() ) );
+          }
+     }
+
+     void ParsingFrom( RequestFields&& fields ) override
+     {
+          busName = std::move( fields.name );
+          bus = Bus( fields.isRoundtrip? Bus::Type::Circular: Bus::Type::Linear );
+          for( auto& stopName: fields.stops )
+          {
+               bus->AddStop( std::move( stopName ) );
           }
      }
 
@@ -80,24 +128,41 @@ struct GetBusStats
           id = requestMap.at( "id" ).AsInt();
      }
 
-     Json::Node Process( Transport& transport ) const override
+     void ParsingFrom( RequestFields&& fields ) override
      {
-          std::map< std::string, Json::Node > result;
-          result[ "request_id" ] = id;
+          busName = std::move( fields.name );
+          id = fields.id;
+     }
+
+     void Process( Transport& transport, Json::Writer& writer ) const override
+     {
+          Write( transport, writer );
+     }
+
+     void Process( Transport::Reader& reader, Json::Writer& writer ) const override
+     {
+          Write( reader, writer );
+     }
+
+     template< typename Source >
+     void Write( Source& transport, Json::Writer& writer ) const
+     {
+          writer.BeginObject();
+          writer.Key( "request_id" ).Value( id );
 
           auto stats = transport.GetBusStats( busName );
           if( !stats.has_value() )
           {
-               result[ "error_message" ] = std::string( "not found" );
-               return Json::Node( result );
+               writer.Key( "error_message" ).Value( "not found" );
+               writer.EndObject();
+               return;
           }
 
-          result[ "stop_count" ] = static_cast< int >( stats.value().stops );
-          result[ "unique_stop_count" ] = static_cast< int >( stats.value().uniqueStops );
-          result[ "route_length" ] = static_cast< int >( stats.value().lengthInfo.roadLength );
-          result[ "curvature" ] = stats.value().lengthInfo.roadLength / stats.value().lengthInfo.length;
-
-          return Json::Node( result );
+          writer.Key( "stop_count" ).Value( static_cast< int >( stats.value().stops ) );
+          writer.Key( "unique_stop_count" ).Value( static_cast< int >( stats.value().uniqueStops ) );
+          writer.Key( "route_length" ).Value( static_cast< int >( stats.value().lengthInfo.roadLength ) );
+          writer.Key( "curvature" ).Value( stats.value().lengthInfo.roadLength / stats.value().lengthInfo.length );
+          writer.EndObject();
      }
 
      std::string busName;
@@ -114,22 +179,43 @@ struct GetStopBusList: public GetRequest
           id = requestMap.at( "id" ).AsInt();
      }
 
-     Json::Node Process( Transport& transport ) const override
+     void ParsingFrom( RequestFields&& fields ) override
+     {
+          stopName = std::move( fields.name );
+          id = fields.id;
+     }
+
+     void Process( Transport& transport, Json::Writer& writer ) const override
+     {
+          Write( transport, writer );
+     }
+
+     void Process( Transport::Reader& reader, Json::Writer& writer ) const override
+     {
+          Write( reader, writer );
+     }
+
+     template< typename Source >
+     void Write( Source& transport, Json::Writer& writer ) const
      {
-          std::map< std::string, Json::Node > result;
-          result[ "request_id" ] = id;
+          writer.BeginObject();
+          writer.Key( "request_id" ).Value( id );
 
           auto* busList = transport.GetStopBusList( stopName );
           if( !busList )
           {
-               result[ "error_message" ] = std::string( "not found" );
-               return Json::Node( result );
+               writer.Key( "error_message" ).Value( "not found" );
+               writer.EndObject();
+               return;
           }
 
-          std::vector< Json::Node > buses( busList->begin(), busList->end() );
-          result[ "buses" ] = std::move( buses );
-
-          return Json::Node( result );
+          writer.Key( "buses" ).BeginArray();
+          for( const auto busId: *busList )
+          {
+               writer.Value( transport.GetBusName( busId ) );
+          }
+          writer.EndArray();
+          writer.EndObject();
      }
 
      std::string stopName;
@@ -147,27 +233,44 @@ struct GetRoute: public GetRequest
           to = requestMap.at( "to" ).AsString();
      }
 
-     Json::Node Process( Transport& transport ) const override
+     void ParsingFrom( RequestFields&& fields ) override
+     {
+          id = fields.id;
+          from = std::move( fields.from );
+          to = std::move( fields.to );
+     }
+
+     void Process( Transport& transport, Json::Writer& writer ) const override
+     {
+          Write( transport, writer );
+     }
+
+     void Process( Transport::Reader& reader, Json::Writer& writer ) const override
+     {
+          Write( reader, writer );
+     }
+
+     template< typename Source >
+     void Write( Source& transport, Json::Writer& writer ) const
      {
-          std::map< std::string, Json::Node > result;
-          result[ "request_id" ] = id;
+          writer.BeginObject();
+          writer.Key( "request_id" ).Value( id );
           auto routeResult = transport.GetRoute( from, to );
           if( auto res = std::get_if< Transport::RouteResult >( &routeResult ) )
           {
-               result[ "total_time" ] = res->time;
-               std::vector< Json::Node > jsonItems;
-               jsonItems.reserve( res->items.size() );
+               writer.Key( "total_time" ).Value( res->time );
+               writer.Key( "items" ).BeginArray();
                for( auto const& item: res->items )
                {
-                    jsonItems.push_back( item->GetItemInfo() );
+                    item->WriteItemInfo( writer );
                }
-               result[ "items" ] = jsonItems;
+               writer.EndArray();
           }
           else
           {
-               result[ "error_message" ] = std::get< std::string >( routeResult );
+               writer.Key( "error_message" ).Value( std::get< std::string >( routeResult ) );
           }
-          return Json::Node( result );
+          writer.EndObject();
      }
 
      std::string from;
@@ -182,23 +285,56 @@ struct AddSettings: public AddRequest
      {
           busWaitTime = request.AsMap().at( "bus_wait_time" ).AsInt();
           busVelocity = request.AsMap().at( "bus_velocity" ).AsInt();
+          if( auto it = request.AsMap().find( "router_threads" ); it != request.AsMap().end() )
+          {
+               routerThreads = it->second.AsInt();
+          }
+          if( auto it = request.AsMap().find( "routing_mode" ); it != request.AsMap().end() )
+          {
+               routingMode = ToRoutingMode( it->second.AsString() );
+          }
+          if( auto it = request.AsMap().find( "stat_threads" ); it != request.AsMap().end() )
+          {
+               statThreads = it->second.AsInt();
+          }
+     }
+
+     void ParsingFrom( RequestFields&& fields ) override
+     {
+          busWaitTime = fields.busWaitTime;
+          busVelocity = fields.busVelocity;
+          routerThreads = fields.routerThreads;
+          routingMode = ToRoutingMode( fields.routingMode );
+          statThreads = fields.statThreads;
+     }
+
+     static Transport::Settings::RoutingMode ToRoutingMode( std::string_view mode )
+     {
+          return mode == "contraction_hierarchies"
+                 ? Transport::Settings::ContractionHierarchies
+                 : Transport::Settings::Dijkstra;
      }
 
      void Process( Transport& transport ) const override
      {
           double busVelocityMs = static_cast< double >( busVelocity ) * 1000.0 / 60.0;
           transport.SetSettings(
-                    { .busWaitTime = static_cast< double >( busWaitTime ), .busVelocity = busVelocityMs } );
+                    { .busWaitTime = static_cast< double >( busWaitTime ), .busVelocity = busVelocityMs,
+                      .routerThreads = static_cast< size_t >( std::max( routerThreads, 0 ) ),
+                      .routingMode = routingMode,
+                      .statThreads = static_cast< size_t >( std::max( statThreads, 0 ) ) } );
      }
 
      int busWaitTime = 0;
      int busVelocity = 0;
+     int routerThreads = 0;
+     Transport::Settings::RoutingMode routingMode = Transport::Settings::Dijkstra;
+     int statThreads = 0;
 };
 
-RequestPtr ParsingRequest( Request::Type type, const Json::Node& requestNode )
+// nullptr for an unknown object
+RequestPtr CreateRequest( Request::Type type, std::string_view object )
 {
-     const std::string& object = requestNode.AsMap().at( "type" ).AsString();
-
      RequestPtr request;
      if( object == "Stop" )
      {
@@ -240,16 +376,21 @@ RequestPtr ParsingRequest( Request::Type type, const Json::Node& requestNode )
                     assert( false );
           }
      }
-     else
+
+     return request;
+}
+
+RequestPtr ParsingRequest( Request::Type type, const Json::Node& requestNode )
+{
+     RequestPtr request = CreateRequest( type, requestNode.AsMap().at( "type" ).AsString() );
+     if( request )
      {
-          assert( false );
+          request->ParsingFrom( requestNode );
      }
-
-     request->ParsingFrom( requestNode );
      return request;
 }
 
-std::vector< RequestPtr > ReadRequests( std::istream& in = std::cin )
+std::vector< RequestPtr > ReadRequestsFromDocument( std::istream& in )
 {
      std::vector< RequestPtr > requests;
      auto doc = Json::Load( in );
@@ -267,10 +408,12 @@ std::vector< RequestPtr > ReadRequests( std::istream& in = std::cin )
      for( const auto& request: addRequests )
      {
           requests.push_back( ParsingRequest( Request::Add, request ) );
+          assert( requests.back() );
      }
      for( const auto& request: getRequests )
      {
           requests.push_back( ParsingRequest( Request::Get, request ) );
+          assert( requests.back() );
      }
 
 
@@ -278,48 +421,456 @@ std::vector< RequestPtr > ReadRequests( std::istream& in = std::cin )
      return requests;
 }
 
-std::vector< Json::Node > ProcessRequests( const std::vector< RequestPtr >& requests )
+// Builds requests straight from parse events: members of a request object
+// are collected into RequestFields until the object closes
+class RequestReader
+          : public Json::Handler
 {
-     std::vector< Json::Node > responses;
+public:
+     std::vector< RequestPtr > TakeRequests()
+     {
+          std::vector< RequestPtr > requests;
+          requests.reserve( addRequests_.size() + getRequests_.size() + 1 );
+          if( settingsRequest_ )
+          {
+               requests.push_back( std::move( settingsRequest_ ) );
+          }
+          std::move( addRequests_.begin(), addRequests_.end(), std::back_inserter( requests ) );
+          std::move( getRequests_.begin(), getRequests_.end(), std::back_inserter( requests ) );
+          return requests;
+     }
+
+     void StartObject() override
+     {
+          Enter();
+          if( InRecord() )
+          {
+               fields_ = {};
+          }
+     }
+
+     void Key( std::string_view key ) override
+     {
+          if( depth_ == RootDepth )
+          {
+               section_ = key == "base_requests" ? Section::Add
+                          : key == "stat_requests" ? Section::Get
+                          : key == "routing_settings" ? Section::Settings
+                          : Section::Other;
+               field_.clear();
+          }
+          else if( InRecord() )
+          {
+               field_ = key;
+          }
+          else if( depth_ == MemberDepth )
+          {
+               stopName_ = key;
+               field_.clear();
+          }
+     }
+
+     void EndObject() override
+     {
+          if( InRecord() && section_ != Section::Settings )
+          {
+               const auto type = section_ == Section::Add ? Request::Add : Request::Get;
+               RequestPtr request = CreateRequest( type, fields_.type );
+               assert( request );
+               request->ParsingFrom( std::move( fields_ ) );
+               ( type == Request::Add ? addRequests_ : getRequests_ ).push_back( std::move( request ) );
+          }
+          else if( InRecord() )
+          {
+               settingsRequest_ = std::make_unique< AddSettings >();
+               settingsRequest_->ParsingFrom( std::move( fields_ ) );
+          }
+          --depth_;
+     }
+
+     void StartArray() override
+     {
+          Enter();
+     }
+
+     void EndArray() override
+     {
+          --depth_;
+     }
+
+     void Value( int64_t value ) override
+     {
+          if( InMember( "road_distances" ) )
+          {
+               fields_.roadDistances.emplace_back( stopName_, CheckedRoadDistance( value ) );
+          }
+          else if( !InRecord() )
+          {
+               return;
+          }
+          else if( field_ == "id" )
+          {
+               fields_.id = static_cast< int >( value );
+          }
+          else if( field_ == "bus_wait_time" )
+          {
+               fields_.busWaitTime = static_cast< int >( value );
+          }
+          else if( field_ == "bus_velocity" )
+          {
+               fields_.busVelocity = static_cast< int >( value );
+          }
+          else if( field_ == "router_threads" )
+          {
+               fields_.routerThreads = static_cast< int >( value );
+          }
+          else if( field_ == "stat_threads" )
+          {
+               fields_.statThreads = static_cast< int >( value );
+          }
+          else
+          {
+               Value( static_cast< double >( value ) );
+          }
+     }
+
+     void Value( double value ) override
+     {
+          // integers beyond int64 arrive as doubles
+          if( InMember( "road_distances" ) )
+          {
+               throw std::out_of_range( "road distance is not an integer in range" );
+          }
+          else if( !InRecord() )
+          {
+               return;
+          }
+          else if( field_ == "id" || field_ == "bus_wait_time" || field_ == "bus_velocity"
+                   || field_ == "router_threads" || field_ == "stat_threads" )
+          {
+               // the document reader refuses these as well
+               throw std::invalid_argument( field_ + " is not an integer" );
+          }
+          else if( field_ == "latitude" )
+          {
+               fields_.latitude = value;
+          }
+          else if( field_ == "longitude" )
+          {
+               fields_.longitude = value;
+          }
+     }
+
+     void Value( bool value ) override
+     {
+          if( InRecord() && field_ == "is_roundtrip" )
+          {
+               fields_.isRoundtrip = value;
+          }
+     }
+
+     void Value( std::string_view value ) override
+     {
+          if( InMember( "stops" ) )
+          {
+               fields_.stops.emplace_back( value );
+          }
+          else if( !InRecord() )
+          {
+               return;
+          }
+          else if( field_ == "type" )
+          {
+               fields_.type = value;
+          }
+          else if( field_ == "name" )
+          {
+               fields_.name = value;
+          }
+          else if( field_ == "from" )
+          {
+               fields_.from = value;
+          }
+          else if( field_ == "to" )
+          {
+               fields_.to = value;
+          }
+          else if( field_ == "routing_mode" )
+          {
+               fields_.routingMode = value;
+          }
+     }
+
+private:
+     enum class Section
+     {
+          Add,
+          Get,
+          Settings,
+          Other
+     };
+
+     // nesting of open objects and arrays: root object, routing_settings or
+     // a requests array, a request object, its road_distances or stops
+     static constexpr int RootDepth = 1;
+     static constexpr int SettingsDepth = 2;
+     static constexpr int RequestDepth = 3;
+     static constexpr int MemberDepth = 4;
+
+     // a container opening at MemberDepth takes over the field naming it
+     void Enter()
+     {
+          ++depth_;
+          if( depth_ == MemberDepth )
+          {
+               member_ = std::move( field_ );
+          }
+          field_.clear();
+     }
+
+     // directly inside routing_settings or a request object
+     bool InRecord() const
+     {
+          return section_ == Section::Settings ? depth_ == SettingsDepth
+                 : section_ != Section::Other && depth_ == RequestDepth;
+     }
+
+     // directly inside the given member container of a request
+     bool InMember( std::string_view member ) const
+     {
+          return ( section_ == Section::Add || section_ == Section::Get ) && depth_ == MemberDepth && member_ == member;
+     }
+
+     int depth_ = 0;
+     Section section_ = Section::Other;
+     // key of the record member being read, empty while no value is expected
+     std::string field_;
+     std::string member_;
+     std::string stopName_;
+     RequestFields fields_;
+     RequestPtr settingsRequest_;
+     std::vector< RequestPtr > addRequests_;
+     std::vector< RequestPtr > getRequests_;
+};
+
+std::vector< RequestPtr > ReadRequests( std::istream& in = std::cin )
+{
+     RequestReader reader;
+     Json::Parse( in, reader );
+     return reader.TakeRequests();
+}
+
+// Parses a document already in memory, such as a MappedFile, without copying it
+std::vector< RequestPtr > ReadRequests( std::string_view input )
+{
+     RequestReader reader;
+     Json::Parse( input, reader );
+     return reader.TakeRequests();
+}
+
+// Answers the Get requests [ begin, end ) on threadCount threads, each with
+// its own Transport::Reader. Threads claim blocks of requests from a shared
+// cursor, so a thread that finishes early picks up the remaining work. Every
+// block's output is kept in its own string and blocks are output in request order
+void ProcessGetRequests( const std::vector< RequestPtr >& requests, size_t begin, size_t end,
+                         Transport& transport, Json::Writer& writer, size_t threadCount )
+{
+     constexpr size_t BlockSize = 32;
+     transport.Freeze();
+
+     const size_t blockCount = ( end - begin + BlockSize - 1 ) / BlockSize;
+     std::vector< std::string > blocks( blockCount );
+     std::atomic< size_t > nextBlock = 0;
+     auto worker = [ & ]
+     {
+          Transport::Reader reader( transport );
+          // one stream and writer per thread, emptied after every block
+          std::ostringstream os;
+          Json::Writer blockWriter( os );
+          for( size_t block = nextBlock++; block < blockCount; block = nextBlock++ )
+          {
+               const size_t blockBegin = begin + block * BlockSize;
+               for( size_t idx = blockBegin; idx < std::min( blockBegin + BlockSize, end ); ++idx )
+               {
+                    dynamic_cast< const GetRequest& >( *requests[ idx ] ).Process( reader, blockWriter );
+               }
+               blockWriter.Flush();
+               blocks[ block ] = std::move( os ).str();
+               os.str( {} );
+               blockWriter.Reset();
+          }
+     };
+
+     std::vector< std::future< void > > futures;
+     threadCount = std::clamp< size_t >( threadCount, 1, std::max< size_t >( blockCount, 1 ) );
+     futures.reserve( threadCount - 1 );
+     for( size_t thread = 1; thread < threadCount; ++thread )
+     {
+          futures.push_back( std::async( std::launch::async, worker ) );
+     }
+     worker();
+     for( auto& future: futures )
+     {
+          future.get();
+     }
+
+     for( const auto& block: blocks )
+     {
+          writer.Raw( block );
+     }
+}
+
+// Responses are written to os as a JSON array while requests are processed
+void ProcessRequests( const std::vector< RequestPtr >& requests, std::ostream& os = std::cout )
+{
+     Json::Writer writer( os );
+     writer.BeginArray();
      Transport transport;
-     for( const auto& request: requests )
+     for( size_t idx = 0; idx < requests.size(); )
      {
+          const auto& request = requests[ idx ];
           switch( request->type )
           {
                case Request::Add:
                {
                     const auto& addRequest = dynamic_cast< const AddRequest& >( *request );
                     addRequest.Process( transport );
+                    ++idx;
                }
                     break;
                case Request::Get:
                {
+                    if( const size_t threads = transport.GetSettings().statThreads; threads > 0 )
+                    {
+                         // a run of Get requests sees the same network, so they are independent
+                         size_t end = idx;
+                         while( end < requests.size() && requests[ end ]->type == Request::Get )
+                         {
+                              ++end;
+                         }
+                         ProcessGetRequests( requests, idx, end, transport, writer, threads );
+                         idx = end;
+                         break;
+                    }
                     const auto& getRequest = dynamic_cast< const GetRequest& >( *request );
-                    responses.push_back( getRequest.Process( transport ) );
+                    getRequest.Process( transport, writer );
+                    ++idx;
                }
                     break;
           }
      }
-     return responses;
+     writer.EndArray();
 }
 
-void PrintResponses( const std::vector< Json::Node >& responses, std::ostream& os = std::cout )
+// Applies the base requests and settings, stat requests of the document are skipped
+void BuildNetwork( const std::vector< RequestPtr >& requests, Transport& transport )
 {
-     os << '[';
-     bool first = true;
-     for( const auto& response: responses )
+     for( const auto& request: requests )
      {
-          if( first )
+          if( request->type == Request::Add )
           {
-               first = false;
+               dynamic_cast< const AddRequest& >( *request ).Process( transport );
           }
-          else
+     }
+     transport.Freeze();
+}
+
+// data is either a snapshot or a JSON document with base requests
+Transport LoadNetwork( std::string_view data )
+{
+     if( SnapshotReader::IsSnapshot( data ) )
+     {
+          return Transport::LoadSnapshot( data );
+     }
+     Transport transport;
+     BuildNetwork( ReadRequests( data ), transport );
+     return transport;
+}
+
+// Answers stat request objects given as lines of JSON for one client, both
+// on stdin and on a socket. The writer and its buffer are reused line to line
+class LineSession
+{
+public:
+     explicit LineSession( const Transport& transport )
+               : reader_( transport )
+               , writer_( output_ )
+     {}
+
+     // the answer stays valid until the next call; blank lines get an empty one
+     std::string_view Answer( std::string_view line )
+     {
+          if( line.find_first_not_of( " \t\r" ) == std::string_view::npos )
           {
-               os << ',';
+               return {};
           }
-          response.Print( os );
+          Clear();
+          try
+          {
+               const auto doc = Json::Load( line );
+               if( RequestPtr request = ParsingRequest( Request::Get, doc.GetRoot() ) )
+               {
+                    dynamic_cast< const GetRequest& >( *request ).Process( reader_, writer_ );
+                    writer_.Flush();
+                    return output_.view();
+               }
+          }
+          catch( const std::exception& )
+          {
+          }
+          Clear();
+          writer_.BeginObject();
+          writer_.Key( "error_message" ).Value( "invalid request" );
+          writer_.EndObject();
+          writer_.Flush();
+          return output_.view();
+     }
+
+private:
+     // empties the stream but keeps its storage
+     void Clear()
+     {
+          std::string text = std::move( output_ ).str();
+          text.clear();
+          output_.str( std::move( text ) );
+          writer_.Reset();
      }
-     os << ']';
+
+     Transport::Reader reader_;
+     std::ostringstream output_;
+     Json::Writer writer_;
+};
+
+// Answers newline-delimited stat requests as they arrive, one line each
+void Serve( const Transport& transport, std::istream& in, std::ostream& os )
+{
+     LineSession session( transport );
+     for( std::string line; std::getline( in, line ); )
+     {
+          if( const std::string_view answer = session.Answer( line ); !answer.empty() )
+          {
+               os << answer << std::endl;
+          }
+     }
+}
+
+// Every connection gets its own session, so clients are answered concurrently
+void Serve( const Transport& transport, SocketServer& server )
+{
+     server.Run( [ &transport ]
+                 {
+                      auto session = std::make_shared< LineSession >( transport );
+                      return [ session ]( std::string_view line )
+                      {
+                           return session->Answer( line );
+                      };
+                 } );
+}
+
+void Serve( const Transport& transport, const std::string& socketPath )
+{
+     SocketServer server( socketPath, R"({"error_message":"request too long"})" );
+     Serve( transport, server );
 }
 
 void BusTest()
@@ -471,6 +1022,155 @@ void TransportTest()
      }
 }
 
+void RoadDistancesTest()
+{
+     RoadDistances distances;
+     ASSERT( !distances.Find( 0, 1 ).has_value() );
+     for( RoadDistances::StopId stop = 0; stop < 1000; ++stop )
+     {
+          distances.Set( stop, stop + 1, stop * 10 );
+     }
+     distances.SetIfAbsent( 5, 6, 1 );
+     distances.SetIfAbsent( 6, 5, 7 );
+     distances.Set( 0, 1, 3 );
+     ASSERT_EQUAL( distances.Size(), 1001u );
+     ASSERT_EQUAL( distances.Find( 0, 1 ).value(), 3u );
+     ASSERT_EQUAL( distances.Find( 5, 6 ).value(), 50u );
+     ASSERT_EQUAL( distances.Find( 6, 5 ).value(), 7u );
+     ASSERT_EQUAL( distances.Find( 999, 1000 ).value(), 9990u );
+     ASSERT( !distances.Find( 1, 0 ).has_value() );
+
+     auto along = distances.FindAlong( { 4, 5, 6, 5, 9 } );
+     ASSERT_EQUAL( along.size(), 4u );
+     ASSERT_EQUAL( along[ 0 ].value(), 40u );
+     ASSERT_EQUAL( along[ 2 ].value(), 7u );
+     ASSERT( !along[ 3 ].has_value() );
+
+     // lengths that do not fit unsigned int are rejected by both readers
+     for( const std::string length: { "-1", "4294967296", "100000000000000000000" } )
+     {
+          const std::string document = R"({"routing_settings": {"bus_wait_time": 1, "bus_velocity": 1}, "stat_requests": [],)"
+                                       R"("base_requests": [{"type": "Stop", "name": "A", "latitude": 0, "longitude": 0,)"
+                                       R"("road_distances": {"B": )" + length + "}}]}";
+          bool streamRejected = false;
+          try
+          {
+               ReadRequests( std::string_view( document ) );
+          }
+          catch( const std::out_of_range& )
+          {
+               streamRejected = true;
+          }
+          ASSERT( streamRejected );
+
+          bool documentRejected = false;
+          try
+          {
+               std::istringstream in( document );
+               ReadRequestsFromDocument( in );
+          }
+          catch( const std::exception& )
+          {
+               documentRejected = true;
+          }
+          ASSERT( documentRejected );
+     }
+}
+
+void RouterTest()
+{
+     Graph::DirectedWeightedGraph< double > graph( 4 );
+     graph.AddEdge( { 0, 1, 1 } );
+     graph.AddEdge( { 1, 2, 1 } );
+     graph.AddEdge( { 0, 2, 3 } );
+     graph.AddEdge( { 2, 3, 1 } );
+
+     Graph::Router< double > router( graph, 1 );
+     std::vector< Graph::EdgeId > edges;
+     ASSERT_EQUAL( router.FindRoute( 0, 3, edges ).value(), 3 );
+     ASSERT_EQUAL( edges, ( std::vector< Graph::EdgeId > { 0, 1, 3 } ) );
+     ASSERT( !router.FindRoute( 3, 0, edges ).has_value() );
+     ASSERT( edges.empty() );
+     ASSERT( router.FindRoute( 3, 3, edges ).has_value() );
+     ASSERT_EQUAL( router.FindRoute( 0, 2, edges ).value(), 2 );
+     ASSERT_EQUAL( router.FindRoute( 0, 1, edges ).value(), 1 );
+
+     auto stats = router.GetCacheStats();
+     ASSERT_EQUAL( stats.hits, 2u );
+     ASSERT_EQUAL( stats.misses, 3u );
+     ASSERT_EQUAL( stats.size, 1u );
+
+     graph.Freeze();
+     ASSERT( graph.IsFrozen() );
+     ASSERT_EQUAL( Graph::Router< double >( graph ).FindRoute( 0, 3, edges ).value(), 3 );
+     ASSERT_EQUAL( graph.GetOutgoingEdges( 0 ).begin()->to, 1u );
+     graph.AddEdge( { 3, 0, 1 } );
+     ASSERT( !graph.IsFrozen() );
+
+     Graph::Router< double > parallelRouter( graph, 4 );
+     parallelRouter.Precompute( { 0, 1, 2, 3 }, 3 );
+     ASSERT_EQUAL( parallelRouter.GetCacheStats().size, 4u );
+     ASSERT_EQUAL( parallelRouter.FindRoute( 1, 3, edges ).value(), 2 );
+     ASSERT_EQUAL( parallelRouter.GetCacheStats().misses, 0u );
+
+     graph.Freeze();
+     Graph::Router< double >::Reader reader( parallelRouter );
+     ASSERT_EQUAL( reader.FindRoute( 3, 2, edges ).value(), 3 );
+     ASSERT_EQUAL( edges, ( std::vector< Graph::EdgeId > { 4, 0, 1 } ) );
+     ASSERT_EQUAL( Graph::Router< double >::Reader( router ).FindRoute( 2, 2, edges ).value(), 0 );
+     ASSERT( edges.empty() );
+}
+
+void ContractionHierarchyTest()
+{
+     const size_t vertexCount = 60;
+     Graph::DirectedWeightedGraph< double > graph( vertexCount );
+     unsigned seed = 17;
+     auto next = [ &seed ]
+     {
+          seed = seed * 1103515245 + 12345;
+          return ( seed >> 16 ) & 0x7fff;
+     };
+     for( size_t i = 0; i < vertexCount * 4; ++i )
+     {
+          graph.AddEdge( { next() % vertexCount, next() % vertexCount, static_cast< double >( next() % 100 ) } );
+     }
+
+     Graph::Router< double > router( graph );
+     Graph::ContractionHierarchy< double > hierarchy( graph );
+     Graph::ContractionHierarchy< double >::Reader reader( hierarchy );
+     std::vector< Graph::EdgeId > expectedEdges;
+     std::vector< Graph::EdgeId > edges;
+     std::vector< Graph::EdgeId > readerEdges;
+     for( Graph::VertexId from = 0; from < vertexCount; ++from )
+     {
+          for( Graph::VertexId to = 0; to < vertexCount; ++to )
+          {
+               auto expected = router.FindRoute( from, to, expectedEdges );
+               auto weight = hierarchy.FindRoute( from, to, edges );
+               ASSERT_EQUAL( weight.has_value(), expected.has_value() );
+               if( !weight )
+               {
+                    continue;
+               }
+               ASSERT_EQUAL( *weight, *expected );
+               Graph::VertexId vertex = from;
+               double edgesWeight = 0;
+               for( const Graph::EdgeId edgeId : edges )
+               {
+                    const auto& edge = graph.GetEdge( edgeId );
+                    ASSERT_EQUAL( edge.from, vertex );
+                    vertex = edge.to;
+                    edgesWeight += edge.weight;
+               }
+               ASSERT_EQUAL( vertex, to );
+               ASSERT_EQUAL( edgesWeight, *weight );
+               ASSERT_EQUAL( reader.FindRoute( from, to, readerEdges ).value(), *weight );
+               ASSERT_EQUAL( readerEdges, edges );
+          }
+     }
+}
+
 void JsonReadTest()
 {
      static const std::string inStr = "{\n"
@@ -493,6 +1193,524 @@ void JsonReadTest()
      ASSERT_EQUAL( map.at("double1").AsDouble(), 123.321 );
      ASSERT_EQUAL( map.at("double2").AsDouble(), -123.321 );
      ASSERT_EQUAL( map.at("double3").AsDouble(), 123 );
+
+     auto bufferDoc = Json::Load( std::string_view( inStr ) );
+     const auto& bufferMap = bufferDoc.GetRoot().AsMap();
+     ASSERT( bufferMap.at("bool_true").AsBool() );
+     ASSERT_EQUAL( bufferMap.at("double2").AsDouble(), -123.321 );
+     ASSERT_EQUAL( bufferMap.at("double3").AsInt(), 123 );
+
+     // loaded tree lives in the document arena
+     ASSERT( bufferMap.get_allocator().resource() != std::pmr::get_default_resource() );
+}
+
+void JsonNumberReadTest()
+{
+     static const std::string inStr = R"([0.1, 1e5, -2.5E-3, 55.611717, 3000000000, -9223372036854775807, 1e19, 18446744073709551616])";
+     for( const auto mode: { Json::ParseMode::Sequential, Json::ParseMode::Indexed } )
+     {
+          auto doc = Json::Load( inStr, mode );
+          const auto& numbers = doc.GetRoot().AsArray();
+          ASSERT_EQUAL( numbers.size(), 8u );
+          ASSERT_EQUAL( numbers[ 0 ].AsDouble(), 0.1 );
+          ASSERT_EQUAL( numbers[ 1 ].AsDouble(), 1e5 );
+          ASSERT_EQUAL( numbers[ 2 ].AsDouble(), -2.5e-3 );
+          ASSERT_EQUAL( numbers[ 3 ].AsDouble(), 55.611717 );
+          ASSERT_EQUAL( numbers[ 4 ].AsInt64(), 3000000000 );
+          ASSERT_EQUAL( numbers[ 5 ].AsInt64(), -9223372036854775807 );
+          ASSERT_EQUAL( numbers[ 6 ].AsDouble(), 1e19 );
+          ASSERT_EQUAL( numbers[ 7 ].AsDouble(), 18446744073709551616. );
+     }
+}
+
+void JsonStringTest()
+{
+     static const std::string inStr = R"({"say \"hi\"": "a\\b\/c\n\tAé€🚌\udc00"})";
+     static const std::string key = "say \"hi\"";
+     static const std::string value = "a\\b/c\n\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x9a\x8c\xef\xbf\xbd";
+     for( const auto mode: { Json::ParseMode::Sequential, Json::ParseMode::Indexed } )
+     {
+          auto doc = Json::Load( inStr, mode );
+          ASSERT_EQUAL( std::string( doc.GetRoot().AsMap().at( key ).AsString() ), value );
+     }
+
+     struct Strings: Json::Handler
+     {
+          void StartObject() override {}
+          void Key( std::string_view key ) override { values.emplace_back( key ); }
+          void EndObject() override {}
+          void StartArray() override {}
+          void EndArray() override {}
+          void Value( int64_t ) override {}
+          void Value( double ) override {}
+          void Value( bool ) override {}
+          void Value( std::string_view value ) override { values.emplace_back( value ); }
+
+          std::vector< std::string > values;
+     } strings;
+     std::istringstream in( inStr );
+     Json::Parse( in, strings );
+     ASSERT_EQUAL( strings.values, std::vector< std::string >( { key, value } ) );
+
+     std::ostringstream os;
+     Json::PrintString( os, std::string( "q\"\\\x01\n/\xc3\xa9" ) );
+     ASSERT_EQUAL( os.str(), "\"q\\\"\\\\\\u0001\\n/\xc3\xa9\"" );
+}
+
+void JsonObjectTest()
+{
+     Json::Object object;
+     object[ "request_id" ] = 1;
+     object[ "error_message" ] = std::string( "not found" );
+     object[ "request_id" ] = 2;
+     ASSERT( !object.emplace( "error_message", 3 ).second );
+     ASSERT_EQUAL( object.size(), 2u );
+     ASSERT_EQUAL( object.at( "request_id" ).AsInt(), 2 );
+     ASSERT( object.find( "items" ) == object.end() );
+
+     std::ostringstream os;
+     Json::Node( object ).Print( os );
+     ASSERT_EQUAL( os.str(), R"({"request_id":2,"error_message":"not found"})" );
+}
+
+void JsonWriterTest()
+{
+     Json::Object object;
+     object[ "request_id" ] = 7;
+     object[ "curvature" ] = 1.2345678;
+     object[ "buses" ] = Json::Array { Json::Node( std::string( "14 \"a\"" ) ), Json::Node( true ) };
+     object[ "items" ] = Json::Array {};
+     std::ostringstream expected;
+     Json::Node( object ).Print( expected );
+
+     std::ostringstream os;
+     {
+          Json::Writer writer( os );
+          writer.BeginObject();
+          writer.Key( "request_id" ).Value( 7 );
+          writer.Key( "curvature" ).Value( 1.2345678 );
+          writer.Key( "buses" ).BeginArray().Value( "14 \"a\"" ).Value( true ).EndArray();
+          writer.Key( "items" ).BeginArray().EndArray();
+          writer.EndObject();
+     }
+     ASSERT_EQUAL( os.str(), expected.str() );
+}
+
+void JsonNumberFormatTest()
+{
+     const std::vector< double > values = { 0., -0., 1., -123.321, 1596.9327142857142, 1e-7, 123456789.,
+                                            0.1 + 0.2, 1e300, -2.5e-310, 55.574371 };
+     for( const double value: values )
+     {
+          for( const int precision: { 1, 6, 17 } )
+          {
+               std::ostringstream expected;
+               expected << std::setprecision( precision ) << value;
+               char chars[ Json::MaxNumberChars ];
+               const std::string actual( chars, Json::FormatNumber( chars, value, { .precision = precision } ) );
+               ASSERT_EQUAL( actual, expected.str() );
+          }
+
+          char chars[ Json::MaxNumberChars ];
+          const std::string shortest( chars, Json::FormatNumber( chars, value, { .mode = Json::NumberFormat::Shortest } ) );
+          ASSERT_EQUAL( std::strtod( shortest.c_str(), nullptr ), value );
+     }
+
+     for( const int value: { 0, -1, 2600, std::numeric_limits< int >::min(), std::numeric_limits< int >::max() } )
+     {
+          char chars[ Json::MaxNumberChars ];
+          ASSERT_EQUAL( std::string( chars, Json::FormatNumber( chars, value ) ), std::to_string( value ) );
+     }
+}
+
+void JsonIndexedReadTest()
+{
+     auto print = []( const Json::Document& doc )
+     {
+          std::ostringstream os;
+          doc.GetRoot().Print( os );
+          return os.str();
+     };
+
+     // keys and values cross 64-byte block boundaries
+     static const std::string inStr = "{\"a long key that spans more than one block of input\": [1, -2.5, true],\n"
+                                      "\"escaped \\\" quote\": \"x\\\\\", \"empty\": {}, \"list\": [ [], [false] ],\n"
+                                      "\"name\" :\t\"Biryulyovo Zapadnoye\" , \"distance\": 2600}";
+     ASSERT_EQUAL( print( Json::Load( inStr, Json::ParseMode::Indexed ) ),
+                   print( Json::Load( inStr, Json::ParseMode::Sequential ) ) );
+
+     std::fstream in( "../transport-input4.json" );
+     std::string input( std::istreambuf_iterator< char >( in ), {} );
+     ASSERT_EQUAL( print( Json::Load( input, Json::ParseMode::Indexed ) ),
+                   print( Json::Load( input, Json::ParseMode::Sequential ) ) );
+
+     for( const std::string_view truncated: { "", "   ", "{\"a\":", "{\"a\"}" } )
+     {
+          for( const auto mode: { Json::ParseMode::Indexed, Json::ParseMode::Sequential } )
+          {
+               bool rejected = false;
+               try
+               {
+                    Json::Load( truncated, mode );
+               }
+               catch( const std::invalid_argument& )
+               {
+                    rejected = true;
+               }
+               ASSERT( rejected );
+          }
+     }
+}
+
+void JsonStreamReadTest()
+{
+     // input is larger than one read chunk, so tokens straddle refills
+     auto respond = []( std::vector< RequestPtr > requests )
+     {
+          std::ostringstream os;
+          ProcessRequests( requests, os );
+          return os.str();
+     };
+
+     std::fstream documentIn( "../transport-input4.json" );
+     std::fstream streamIn( "../transport-input4.json" );
+     ASSERT_EQUAL( respond( ReadRequests( streamIn ) ), respond( ReadRequestsFromDocument( documentIn ) ) );
+
+     // members of an unknown section must not leak into the next request
+     std::ifstream in( "../transport-input4.json" );
+     const std::string input( ( std::istreambuf_iterator< char >( in ) ), std::istreambuf_iterator< char >() );
+     std::string document = input;
+     document.insert( document.find( "\"base_requests\"" ),
+                      R"("render_settings": [ { "road_distances": { "Kiyevskoye sh 50": 1 } } ], )" );
+     std::istringstream otherIn( document );
+     ASSERT_EQUAL( respond( ReadRequests( std::string_view( document ) ) ), respond( ReadRequestsFromDocument( otherIn ) ) );
+
+     // nor do settings keys into unknown root members after them, in any section order
+     const size_t settingsAt = input.find( "\"routing_settings\"" );
+     const size_t baseAt = input.find( "\"base_requests\"" );
+     const size_t statAt = input.find( "\"stat_requests\"" );
+     const std::string settingsText = input.substr( settingsAt, input.find( '}', settingsAt ) + 1 - settingsAt );
+     const std::string baseText = input.substr( baseAt, input.rfind( ',', statAt ) - baseAt );
+     const std::string statText = input.substr( statAt, input.rfind( '}' ) - statAt );
+     const std::string reordered = "{" + statText + R"(, "serialization_settings": 7, )" + baseText + ", " + settingsText
+                                   + R"(, "bus_wait_time": 2, "render_settings": { "id": 3, "bus_velocity": 1 } })";
+     std::istringstream reorderedIn( reordered );
+     ASSERT_EQUAL( respond( ReadRequests( std::string_view( reordered ) ) ), respond( ReadRequestsFromDocument( reorderedIn ) ) );
+     ASSERT_EQUAL( respond( ReadRequests( std::string_view( reordered ) ) ), respond( ReadRequests( std::string_view( input ) ) ) );
+
+     // integer settings are refused when fractional, as the document reader does
+     std::string fractional = input;
+     fractional.insert( fractional.find( ',', fractional.find( "\"bus_velocity\"" ) ), ".5" );
+     for( const bool stream: { true, false } )
+     {
+          bool rejected = false;
+          try
+          {
+               std::istringstream fractionalIn( fractional );
+               stream ? ReadRequests( std::string_view( fractional ) ) : ReadRequestsFromDocument( fractionalIn );
+          }
+          catch( const std::exception& )
+          {
+               rejected = true;
+          }
+          ASSERT( rejected );
+     }
+
+     // input that ends before the document does is an error, as in Json::Load
+     for( const std::string& cut: { std::string(), std::string( " \n" ), input.substr( 0, input.size() / 2 ) } )
+     {
+          for( const bool stream: { true, false } )
+          {
+               std::string message;
+               try
+               {
+                    std::istringstream cutIn( cut );
+                    stream ? ReadRequests( cutIn ) : ReadRequests( std::string_view( cut ) );
+               }
+               catch( const std::invalid_argument& error )
+               {
+                    message = error.what();
+               }
+               ASSERT_EQUAL( message, "Json::Load: unexpected end of input" );
+          }
+     }
+}
+
+void JsonParallelStatTest()
+{
+     std::fstream in( "../transport-input4.json" );
+     const std::string input( std::istreambuf_iterator< char >( in ), {} );
+     const std::string settings = "\"routing_settings\": {";
+     auto withSettings = [ & ]( const std::string& members )
+     {
+          std::string result = input;
+          result.insert( result.find( settings ) + settings.size(), members );
+          std::ostringstream os;
+          ProcessRequests( ReadRequests( std::string_view( result ) ), os );
+          return os.str();
+     };
+
+     ASSERT_EQUAL( withSettings( "\"stat_threads\": 4, " ), withSettings( "" ) );
+     const std::string hierarchy = "\"routing_mode\": \"contraction_hierarchies\", ";
+     ASSERT_EQUAL( withSettings( hierarchy + "\"stat_threads\": 4, " ), withSettings( hierarchy ) );
+}
+
+// Small network and the stat request lines the serving tests send to it;
+// batch is what ProcessRequests prints for the same requests in one document
+struct ServeFixture
+{
+     ServeFixture()
+     {
+          std::string document = base;
+          for( const auto& line: lines )
+          {
+               document += ( &line == &lines.front() ? "" : "," ) + line;
+          }
+          document += "]}";
+          std::ostringstream os;
+          ProcessRequests( ReadRequests( std::string_view( document ) ), os );
+          batch = os.str();
+          BuildNetwork( ReadRequests( std::string_view( base + "]}" ) ), transport );
+     }
+
+     const std::string base = "{\"routing_settings\": {\"bus_wait_time\": 6, \"bus_velocity\": 40}, \"base_requests\": ["
+                              "{\"type\": \"Stop\", \"name\": \"A\", \"latitude\": 55.57, \"longitude\": 37.65,"
+                              " \"road_distances\": {\"B\": 2600}},"
+                              "{\"type\": \"Stop\", \"name\": \"B\", \"latitude\": 55.59, \"longitude\": 37.65,"
+                              " \"road_distances\": {}},"
+                              "{\"type\": \"Bus\", \"name\": \"297\", \"stops\": [\"A\", \"B\"], \"is_roundtrip\": false}"
+                              "], \"stat_requests\": [";
+     const std::vector< std::string > lines = {
+               "{\"type\": \"Bus\", \"name\": \"297\", \"id\": 1}",
+               "{\"type\": \"Stop\", \"name\": \"B\", \"id\": 2}",
+               "{\"type\": \"Route\", \"from\": \"A\", \"to\": \"B\", \"id\": 3}",
+               "{\"type\": \"Bus\", \"name\": \"750\", \"id\": 4}" };
+     std::string batch;
+     Transport transport;
+};
+
+void ServeTest()
+{
+     const ServeFixture fixture;
+     const auto& lines = fixture.lines;
+     std::string requests;
+     for( const auto& line: lines )
+     {
+          requests += line + "\n";
+     }
+     std::istringstream in( requests + "\n{\"type\": \"Bus\"}\n{\"type\": \"Train\", \"id\": 5}\nnot json\n" );
+     std::ostringstream out;
+     Serve( fixture.transport, in, out );
+
+     std::istringstream answers( out.str() );
+     std::string expected = "[";
+     std::string answer;
+     for( size_t idx = 0; idx < lines.size() && std::getline( answers, answer ); ++idx )
+     {
+          expected += ( idx == 0 ? "" : "," ) + answer;
+     }
+     ASSERT_EQUAL( expected + "]", fixture.batch );
+     for( size_t idx = 0; idx < 3; ++idx )
+     {
+          ASSERT( !!std::getline( answers, answer ) );
+          ASSERT_EQUAL( answer, "{\"error_message\":\"invalid request\"}" );
+     }
+     ASSERT( !std::getline( answers, answer ) );
+}
+
+void ServeSocketTest()
+{
+     const ServeFixture fixture;
+     const auto& lines = fixture.lines;
+     std::string pipelined;
+     for( const auto& line: lines )
+     {
+          pipelined += line + "\n\n";
+     }
+     const std::string path = ( std::filesystem::temp_directory_path()
+                                / ( "transport-serve-" + std::to_string( getpid() ) + ".sock" ) ).string();
+
+     auto connectClient = [ &path ]
+     {
+          const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+          sockaddr_un address {};
+          address.sun_family = AF_UNIX;
+          std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+          ASSERT( connect( fd, reinterpret_cast< const sockaddr* >( &address ), sizeof( address ) ) == 0 );
+          return fd;
+     };
+     auto sendText = []( int fd, std::string_view text )
+     {
+          ASSERT_EQUAL( send( fd, text.data(), text.size(), MSG_NOSIGNAL ), static_cast< ssize_t >( text.size() ) );
+     };
+     // answers until the server closes the connection
+     auto receiveAll = []( int fd )
+     {
+          std::string received;
+          char chunk[ 4096 ];
+          for( ssize_t size; ( size = recv( fd, chunk, sizeof( chunk ), 0 ) ) > 0; )
+          {
+               received.append( chunk, static_cast< size_t >( size ) );
+          }
+          close( fd );
+          return received;
+     };
+
+     {
+          SocketServer server( path, "too long" );
+          std::thread serving( [ & ]
+                               {
+                                    Serve( fixture.transport, server );
+                               } );
+
+          // pipelined lines with blank ones between, then one line split across two sends
+          const int client = connectClient();
+          sendText( client, pipelined );
+          sendText( client, lines[ 0 ].substr( 0, 10 ) );
+          std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+          sendText( client, lines[ 0 ].substr( 10 ) + "\n" );
+          shutdown( client, SHUT_WR );
+          std::istringstream in( receiveAll( client ) );
+          std::vector< std::string > answers;
+          for( std::string answer; std::getline( in, answer ); )
+          {
+               answers.push_back( answer );
+          }
+
+          ASSERT_EQUAL( answers.size(), lines.size() + 1 );
+          std::string expected = "[";
+          for( size_t idx = 0; idx < lines.size(); ++idx )
+          {
+               expected += ( idx == 0 ? "" : "," ) + answers[ idx ];
+          }
+          ASSERT_EQUAL( expected + "]", fixture.batch );
+          ASSERT_EQUAL( answers.back(), answers.front() );
+
+          // a client hanging up mid-line does not disturb the next one
+          const int leaving = connectClient();
+          sendText( leaving, lines[ 1 ].substr( 0, 10 ) );
+          close( leaving );
+
+          const int next = connectClient();
+          sendText( next, lines[ 1 ] + "\n" );
+          shutdown( next, SHUT_WR );
+          ASSERT_EQUAL( receiveAll( next ).find( "\"request_id\":2" ), 1u );
+
+          server.Stop();
+          serving.join();
+     }
+     ASSERT( !std::filesystem::exists( path ) );
+}
+
+void SnapshotTest()
+{
+     std::fstream in( "../transport-input4.json" );
+     const std::string input( std::istreambuf_iterator< char >( in ), {} );
+     const std::string settings = "\"routing_settings\": {";
+     auto answerAll = []( const Transport& transport, const std::vector< RequestPtr >& requests )
+     {
+          std::ostringstream os;
+          Json::Writer writer( os );
+          Transport::Reader reader( transport );
+          for( const auto& request: requests )
+          {
+               if( request->type == Request::Get )
+               {
+                    dynamic_cast< const GetRequest& >( *request ).Process( reader, writer );
+               }
+          }
+          writer.Flush();
+          return std::move( os ).str();
+     };
+
+     for( const std::string members: { "", "\"router_threads\": 2, ", "\"routing_mode\": \"contraction_hierarchies\", " } )
+     {
+          std::string document = input;
+          document.insert( document.find( settings ) + settings.size(), members );
+          const auto requests = ReadRequests( std::string_view( document ) );
+          Transport transport;
+          BuildNetwork( requests, transport );
+          const std::string snapshot = transport.SaveSnapshot();
+
+          const Transport loaded = Transport::LoadSnapshot( snapshot );
+          ASSERT_EQUAL( answerAll( loaded, requests ), answerAll( transport, requests ) );
+          ASSERT_EQUAL( Transport::LoadSnapshot( snapshot ).SaveSnapshot(), snapshot );
+     }
+
+     Transport transport;
+     BuildNetwork( ReadRequests( std::string_view( input ) ), transport );
+     std::string snapshot = transport.SaveSnapshot();
+     auto rejects = []( std::string_view data )
+     {
+          try
+          {
+               Transport::LoadSnapshot( data );
+          }
+          catch( const SnapshotError& )
+          {
+               return true;
+          }
+          return false;
+     };
+     ASSERT( rejects( input ) );
+     ASSERT( rejects( std::string_view( snapshot ).substr( 0, snapshot.size() - 1 ) ) );
+     snapshot[ snapshot.size() / 2 ] ^= 1;
+     ASSERT( rejects( snapshot ) );
+     // the layout fingerprint follows magic, version and byte order
+     snapshot = transport.SaveSnapshot();
+     snapshot[ 16 ] ^= 1;
+     ASSERT( rejects( snapshot ) );
+
+     // trees and hierarchies that don't fit the graph are refused, not indexed
+     Graph::DirectedWeightedGraph< double > graph( 3 );
+     graph.AddEdge( { 0, 1, 1 } );
+     graph.AddEdge( { 1, 2, 1 } );
+     graph.AddEdge( { 2, 1, 0 } );
+     graph.Freeze();
+     auto loadsTree = [ &graph ]( const std::vector< double >& weights, const std::vector< Graph::EdgeId >& prevEdges )
+     {
+          SnapshotWriter output( 0 );
+          output.Write< uint64_t >( 1 );
+          output.Write< uint64_t >( 1 );
+          output.Write< uint64_t >( 0 );
+          output.WriteArray( weights );
+          output.WriteArray( prevEdges );
+          const std::string data = output.Finish();
+          SnapshotReader reader( data, 0 );
+          try
+          {
+               Graph::Router< double >::Load( graph, reader );
+          }
+          catch( const SnapshotError& )
+          {
+               return false;
+          }
+          return true;
+     };
+     const Graph::EdgeId none = std::numeric_limits< Graph::EdgeId >::max();
+     ASSERT( loadsTree( { 0, 1, 2 }, { none, 0, 1 } ) );
+     ASSERT( !loadsTree( { 0, 1 }, { none, 0 } ) );
+     ASSERT( !loadsTree( { 0, 1, 2 }, { none, 0, 5 } ) );
+     ASSERT( !loadsTree( { 0, 1, 2 }, { none, 1, 1 } ) );
+     ASSERT( !loadsTree( { 0, 1, 1 }, { none, 2, 1 } ) );
+
+     Graph::DirectedWeightedGraph< double > smaller( 2 );
+     smaller.AddEdge( { 0, 1, 1 } );
+     smaller.Freeze();
+     SnapshotWriter output( 0 );
+     Graph::ContractionHierarchy< double >( graph ).Save( output );
+     const std::string hierarchy = output.Finish();
+     SnapshotReader reader( hierarchy, 0 );
+     bool hierarchyRejected = false;
+     try
+     {
+          Graph::ContractionHierarchy< double >::Load( smaller, reader );
+     }
+     catch( const SnapshotError& )
+     {
+          hierarchyRejected = true;
+     }
+     ASSERT( hierarchyRejected );
 }
 
 void JsonTest1()
@@ -596,8 +1814,7 @@ void JsonTest1()
      std::fstream out("../out1.json", std::ios::out | std::ios::trunc);
 
      auto requests = ReadRequests( in );
-     auto responses = ProcessRequests( requests );
-     PrintResponses( responses, out );
+     ProcessRequests( requests, out );
 }
 
 void JsonTest2()
@@ -828,8 +2045,7 @@ void JsonTest2()
      std::fstream out("../out2.json", std::ios::out | std::ios::trunc);
 
      auto requests = ReadRequests( in );
-     auto responses = ProcessRequests( requests );
-     PrintResponses( responses, out );
+     ProcessRequests( requests, out );
 }
 
 void JsonTest3()
@@ -924,37 +2140,194 @@ void JsonTest3()
      std::fstream out("../out3.json", std::ios::out | std::ios::trunc);
 
      auto requests = ReadRequests( in );
-     auto responses = ProcessRequests( requests );
-     PrintResponses( responses, out );
+     ProcessRequests( requests, out );
 }
 
-void JsonTest4()
+void TransportRouteUpdateTest()
 {
      std::fstream in( "../transport-input4.json" );
+     auto requests = ReadRequests( in );
+     // stops first, then buses one by one as a live feed would deliver them
+     auto order = []( const RequestPtr& request )
+     {
+          return request->type == Request::Get ? 2 : dynamic_cast< const AddBus* >( request.get() ) ? 1 : 0;
+     };
+     std::stable_sort( requests.begin(), requests.end(), [ &order ]( const RequestPtr& lhs, const RequestPtr& rhs )
+     {
+          return order( lhs ) < order( rhs );
+     } );
+
+     std::vector< const GetRoute* > routes;
+     for( const auto& request: requests )
+     {
+          if( auto route = dynamic_cast< const GetRoute* >( request.get() ); route && routes.size() < 50 )
+          {
+               routes.push_back( route );
+          }
+     }
+
+     auto routeTime = []( const Transport& transport, const GetRoute& route ) -> std::optional< double >
+     {
+          auto result = transport.GetRoute( route.from, route.to );
+          if( auto res = std::get_if< Transport::RouteResult >( &result ) )
+          {
+               return res->time;
+          }
+          return std::nullopt;
+     };
+
+     Transport incremental;
+     size_t checks = 0;
+     for( size_t idx = 0; idx < requests.size() && requests[ idx ]->type == Request::Add; ++idx )
+     {
+          dynamic_cast< const AddRequest& >( *requests[ idx ] ).Process( incremental );
+          if( !dynamic_cast< const AddBus* >( requests[ idx ].get() ) || idx % 10 != 0 )
+          {
+               continue;
+          }
+          ++checks;
+
+          Transport rebuilt;
+          for( size_t addIdx = 0; addIdx <= idx; ++addIdx )
+          {
+               dynamic_cast< const AddRequest& >( *requests[ addIdx ] ).Process( rebuilt );
+          }
+          for( const GetRoute* route: routes )
+          {
+               auto expected = routeTime( rebuilt, *route );
+               auto actual = routeTime( incremental, *route );
+               ASSERT_EQUAL( actual.has_value(), expected.has_value() );
+               if( actual )
+               {
+                    ASSERT( std::abs( *actual - *expected ) < 1e-6 );
+               }
+          }
+     }
+     ASSERT( checks > 0 );
+}
+
+void JsonTest4()
+{
+     MappedFile in( "../transport-input4.json" );
 
      std::fstream out("../out4.json", std::ios::out | std::ios::trunc);
 
-     auto requests = ReadRequests( in );
-     auto responses = ProcessRequests( requests );
-     PrintResponses( responses, out );
+     auto requests = ReadRequests( in.Data() );
+     ProcessRequests( requests, out );
 }
 
-int main()
+// Runs one command line mode; input that can't be read or parsed, snapshots
+// that can't be loaded and sockets that can't be bound end it with status 1
+template< typename Mode >
+int RunReportingErrors( Mode mode )
+{
+     try
+     {
+          return mode();
+     }
+     catch( const std::system_error& error )
+     {
+          std::cerr << error.what() << std::endl;
+     }
+     catch( const SnapshotError& error )
+     {
+          std::cerr << error.what() << std::endl;
+     }
+     catch( const std::invalid_argument& error )
+     {
+          std::cerr << error.what() << std::endl;
+     }
+     return 1;
+}
+
+// With a file path argument the input is mapped into memory, otherwise read from stdin.
+// --serve input [socket] keeps the network of input resident and answers
+// newline-delimited stat requests from stdin, or from clients of a Unix-domain socket.
+// --snapshot input.json output saves the network of input.json for --serve to load
+int main( int argc, char* argv[] )
 {
 //     TestRunner testRunner;
 //     RUN_TEST( testRunner, BusTest );
 //     RUN_TEST( testRunner, StopTest );
 //     RUN_TEST( testRunner, TransportTest );
+//     RUN_TEST( testRunner, RoadDistancesTest );
+//     RUN_TEST( testRunner, RouterTest );
+//     RUN_TEST( testRunner, ContractionHierarchyTest );
 //     RUN_TEST( testRunner, JsonReadTest );
+//     RUN_TEST( testRunner, JsonNumberReadTest );
+//     RUN_TEST( testRunner, JsonStringTest );
+//     RUN_TEST( testRunner, JsonObjectTest );
+//     RUN_TEST( testRunner, JsonWriterTest );
+//     RUN_TEST( testRunner, JsonNumberFormatTest );
+//     RUN_TEST( testRunner, JsonIndexedReadTest );
+//     RUN_TEST( testRunner, JsonStreamReadTest );
+//     RUN_TEST( testRunner, JsonParallelStatTest );
+//     RUN_TEST( testRunner, ServeTest );
+//     RUN_TEST( testRunner, ServeSocketTest );
+//     RUN_TEST( testRunner, SnapshotTest );
 //     RUN_TEST( testRunner, JsonTest1 );
 //     RUN_TEST( testRunner, JsonTest2 );
 //     RUN_TEST( testRunner, JsonTest3 );
 //     RUN_TEST( testRunner, JsonTest4 );
+//     RUN_TEST( testRunner, TransportRouteUpdateTest );
 //     return 0;
 
-     auto requests = ReadRequests();
-     auto responses = ProcessRequests( requests );
-     PrintResponses( responses );
+     if( argc > 3 && std::string_view( argv[ 1 ] ) == "--snapshot" )
+     {
+          return RunReportingErrors( [ argv ]
+          {
+               MappedFile input( argv[ 2 ] );
+               Transport transport;
+               BuildNetwork( ReadRequests( input.Data() ), transport );
+               const std::string snapshot = transport.SaveSnapshot();
+
+               // written aside and renamed, so a failed write never leaves a torn snapshot
+               const std::string target = argv[ 3 ];
+               const std::string temporary = target + ".tmp";
+               std::ofstream out( temporary, std::ios::binary | std::ios::trunc );
+               out.write( snapshot.data(), static_cast< std::streamsize >( snapshot.size() ) );
+               out.close();
+               if( !out || std::rename( temporary.c_str(), target.c_str() ) != 0 )
+               {
+                    std::remove( temporary.c_str() );
+                    std::cerr << "can't write snapshot " << target << std::endl;
+                    return 1;
+               }
+               return 0;
+          } );
+     }
+
+     if( argc > 2 && std::string_view( argv[ 1 ] ) == "--serve" )
+     {
+          return RunReportingErrors( [ argc, argv ]
+          {
+               const Transport transport = LoadNetwork( MappedFile( argv[ 2 ] ).Data() );
+               if( argc > 3 )
+               {
+                    Serve( transport, argv[ 3 ] );
+               }
+               else
+               {
+                    Serve( transport, std::cin, std::cout );
+               }
+               return 0;
+          } );
+     }
 
-     return 0;
+     if( argc > 1 )
+     {
+          return RunReportingErrors( [ argv ]
+          {
+               MappedFile input( argv[ 1 ] );
+               ProcessRequests( ReadRequests( input.Data() ) );
+               return 0;
+          } );
+     }
+
+     return RunReportingErrors( []
+     {
+          auto requests = ReadRequests();
+          ProcessRequests( requests );
+          return 0;
+     } );
 }